@@ -0,0 +1,90 @@
+#include "arena.h"
+
+// Allocates "size" bytes from the arena, NULL if out of memory
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+	stats_counters[STAT_ARENA_ALLOCS]++;
+	stats_counters[STAT_ARENA_BYTES] += size;
+	
+	struct arena_block *block = arena->current;
+	while (block != NULL && block->used + size > block->size)
+	{
+		// Reuse blocks kept from earlier lines before allocating new ones
+		block = block->next;
+		if (block != NULL)
+		{
+			block->used = 0;
+		}
+	}
+	
+	if (block == NULL)
+	{
+		size_t block_size = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+		block = (struct arena_block *) malloc(sizeof(struct arena_block) + block_size);
+		if (block == NULL)
+		{
+			perror("malloc");
+			return NULL;
+		}
+		block->size = block_size;
+		block->used = 0;
+		stats_counters[STAT_ARENA_BLOCKS]++;
+		
+		// Link after the current block so the chain stays in use order
+		if (arena->current != NULL)
+		{
+			block->next = arena->current->next;
+			arena->current->next = block;
+		}
+		else
+		{
+			block->next = arena->first;
+			arena->first = block;
+		}
+	}
+	
+	arena->current = block;
+	void *memory = block->data + block->used;
+	block->used += size;
+	return memory;
+}
+
+// Copies "length" bytes of "string" into the arena and terminates them
+char *arena_strndup(struct arena *arena, const char *string, size_t length)
+{
+	char *copy = (char *) arena_alloc(arena, length + 1);
+	if (copy == NULL)
+	{
+		return NULL;
+	}
+	
+	memcpy(copy, string, length);
+	copy[length] = '\0';
+	return copy;
+}
+
+// Releases everything allocated from the arena, keeping its blocks for reuse
+void arena_reset(struct arena *arena)
+{
+	arena->current = arena->first;
+	if (arena->first != NULL)
+	{
+		arena->first->used = 0;
+	}
+}
+
+// Frees all blocks of the arena
+void arena_free(struct arena *arena)
+{
+	struct arena_block *block = arena->first;
+	while (block != NULL)
+	{
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+	
+	arena->first = NULL;
+	arena->current = NULL;
+}
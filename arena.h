@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGN 16
+
+// A block of arena memory
+struct arena_block
+{
+	struct arena_block *next;
+	size_t size; // Usable bytes in data
+	size_t used; // Bytes handed out
+	char data[];
+};
+
+// Bump allocator: everything allocated is released at once by arena_reset
+struct arena
+{
+	struct arena_block *first;
+	struct arena_block *current;
+};
+
+// Allocates "size" bytes from the arena, NULL if out of memory
+void *arena_alloc(struct arena *arena, size_t size);
+
+// Copies "length" bytes of "string" into the arena and terminates them
+char *arena_strndup(struct arena *arena, const char *string, size_t length);
+
+// Releases everything allocated from the arena, keeping its blocks for reuse
+void arena_reset(struct arena *arena);
+
+// Frees all blocks of the arena
+void arena_free(struct arena *arena);
+
+#endif
@@ -0,0 +1,55 @@
+#!/bin/sh
+###############################################
+# Launch backend comparison (fork_storm)
+# Usage: launch_backends.sh [THRESHOLD] [update]
+# The fork + execvp backend was removed when
+# commands moved to posix_spawn, so both are
+# built from git: FORK_REV (the last commit
+# launching with fork) and SPAWN_REV (the commit
+# that moved to posix_spawn). Runs fork_storm on
+# each through bench/run.sh and compares them
+# with bench/baseline_fork.txt (before) and
+# bench/baseline_spawn.txt (after). With
+# "update" the results become the baselines.
+# Best of $BENCH_RUNS runs (default 10 here)
+###############################################
+THRESHOLD=${1:-20}
+UPDATE=$2
+FORK_REV=${FORK_REV:-8ffc8d69fe32393dfc1560d64e1fc447e35716c3}
+SPAWN_REV=${SPAWN_REV:-501b14ec7df8ab7598393535ec76d68f3a04c796}
+CC=${CC:-gcc}
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+status=0
+for backend in fork spawn
+do
+	case $backend in
+		fork) rev=$FORK_REV ;;
+		spawn) rev=$SPAWN_REV ;;
+	esac
+	mkdir "$WORK/$backend"
+	if ! git -C "$BENCH/.." archive "$rev" | tar -x -C "$WORK/$backend" || ! $CC -O2 -pthread -o "$WORK/$backend/ucysh" "$WORK/$backend"/*.c 2> /dev/null
+	then
+		echo "Unable to build $rev"
+		exit 1
+	fi
+
+	# Shells of these revisions keep at most 1024 history entries and crash after them -> 1000 commands per run
+	echo "$backend backend ($rev):"
+	BENCH_RUNS=${BENCH_RUNS:-10} BENCH_WORKLOADS=fork_storm BENCH_FORK_STORM=1000 sh "$BENCH/run.sh" "$WORK/$backend/ucysh" "$BENCH/baseline_$backend.txt" "$THRESHOLD" $UPDATE > "$WORK/$backend.out"
+	if [ $? -ne 0 ]
+	then
+		status=1
+	fi
+	cat "$WORK/$backend.out"
+done
+
+# Launches/second of posix_spawn relative to fork
+fork=$(awk '$1 == "fork_storm" { print $2 }' "$WORK/fork.out")
+spawn=$(awk '$1 == "fork_storm" { print $2 }' "$WORK/spawn.out")
+awk -v f="$fork" -v s="$spawn" 'BEGIN { printf "posix_spawn: %d launches/s, fork: %d launches/s (%+.1f%%)\n", s, f, (s - f) * 100 / f }'
+
+exit $status
@@ -0,0 +1,62 @@
+#!/bin/sh
+###############################################
+# 1 MB single-line command test
+# Usage: long_lines.sh SHELL
+# Runs commands on single lines of about 1 MB
+# from a script file, from a file on stdin and
+# from a pipe on stdin, and checks their output:
+# - a 1 MiB word through echo | wc -c
+# - /bin/echo with a 1 MB argument list
+# - a 1 MiB assignment
+# - a 1 MB command joined from lines ending in \
+# - read of a 1 MiB line, then the next line
+# Fails (exit status 1) if any result is wrong
+###############################################
+SHELL_UNDER_TEST=$1
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+word=$(head -c 1048576 /dev/zero | tr '\0' a)
+{
+	echo "echo $word | wc -c > $WORK/word"
+	seq 1 100000 | awk -v out="$WORK/args" '{ s = s " arg" sprintf("%05d", $1 % 100000) } END { print "/bin/echo" s " | wc -c > " out }'
+	echo "x=$word; echo \$x | wc -c > $WORK/assignment"
+	seq 1 1000 | awk -v out="$WORK/continued" '{ printf "echo"; for (i = 0; i < 100; i++) printf " w%08d", i; print " \\" } END { print "| wc -w > " out }'
+	echo "read line; echo \$line | wc -c > $WORK/read"
+	echo "$word"
+	echo "echo after > $WORK/after"
+} > "$WORK/script"
+echo "$word" > "$WORK/input" # read takes stdin, not the script, when the commands come from a file argument
+
+# Expected results: the word with a newline, 100000 arguments of 9 bytes, 1000 x 100 words after the first echo
+expected="word=1048577 args=900000 assignment=1048577 continued=100999 read=1048577 after=after"
+
+status=0
+for mode in script file pipe
+do
+	rm -f "$WORK/word" "$WORK/args" "$WORK/assignment" "$WORK/continued" "$WORK/read" "$WORK/after"
+	case $mode in
+		script) "$SHELL_UNDER_TEST" "$WORK/script" < "$WORK/input" > /dev/null 2>&1 ;;
+		file) "$SHELL_UNDER_TEST" < "$WORK/script" > /dev/null 2>&1 ;;
+		pipe) cat "$WORK/script" | "$SHELL_UNDER_TEST" > /dev/null 2>&1 ;;
+	esac
+
+	result=""
+	for name in word args assignment continued read after
+	do
+		result="$result $name=$(tr -d ' \n' < "$WORK/$name" 2>/dev/null)"
+	done
+	result=${result# }
+
+	if [ "$result" = "$expected" ]
+	then
+		echo "$mode: ok"
+	else
+		echo "$mode: got $result"
+		echo "$mode: expected $expected"
+		status=1
+	fi
+done
+
+exit $status
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "helper_functions.h"
+#include "built_in_functions.h"
+#include "lexer.h"
+#include "expand.h"
+#include "redirect.h"
+#include "variables.h"
+#include "stats.h"
+
+#define MICROBENCH_ROUNDS 15 // Timed rounds of every benchmark, the statistics are taken over them
+#define MICROBENCH_ROUND_NS 20000000ULL // Length of one round, the iterations per round are calibrated to it
+#define MICROBENCH_VARIABLES 10000 // Variables set before the variable benchmarks
+#define MICROBENCH_LONG_WORDS 2000 // Words of the long line
+#define MICROBENCH_MANY_ARGS 256 // Arguments of the many-arguments line (plain, quoted and $variable words)
+#define MICROBENCH_MANY_REDIRECTS 64 // Redirections of the many-redirections line
+#define MICROBENCH_NAME_SIZE 32
+
+// A benchmark: run performs the measured operation once
+struct benchmark
+{
+	const char *name;
+	void (*run)(void);
+};
+
+// Synthetic inputs, built once by make_inputs
+char *short_line; // A typical interactive command
+char *long_line; // echo followed by MICROBENCH_LONG_WORDS words
+char *args_line; // A command with MICROBENCH_MANY_ARGS mixed arguments
+char *redirects_line; // A command with MICROBENCH_MANY_REDIRECTS redirections
+
+char *line_copy = NULL; // Lexing and tokenizing change the line, every run works on a fresh copy
+char **tokens = NULL; // Output of tokenize, and the arguments of index_of and concat
+char **assignments = NULL; // "vN=valueN" for every variable
+char **names = NULL; // "vN" for every variable
+
+struct arena bench_arena = {0};
+volatile long sink = 0; // Results are added here so the compiler keeps the measured calls
+int next_variable = 0; // Variable used by the next run of the variable benchmarks
+
+
+// Helper functions
+
+// Builds the synthetic input lines and the variable names
+int make_inputs(void);
+
+// Copies a line into line_copy
+void copy_line(const char *line);
+
+// Lexes line_copy into the arena, returns the number of tokens
+int lex_copy(const char *line, struct token **lexed);
+
+// Runs a benchmark for "rounds" rounds and prints its statistics
+void measure(struct benchmark *benchmark, int rounds);
+
+// Compares two doubles for qsort
+int compare_doubles(const void *a, const void *b);
+
+
+// Benchmarks
+
+void bench_tokenize_short(void);
+void bench_tokenize_long(void);
+void bench_index_of(void);
+void bench_substr(void);
+void bench_concat(void);
+void bench_lex_short(void);
+void bench_lex_long(void);
+void bench_lex_many_redirects(void);
+void bench_parse_short(void);
+void bench_parse_many_args(void);
+void bench_parse_many_redirects(void);
+void bench_variable_assignment(void);
+void bench_var_get(void);
+void bench_expand_variable(void);
+
+struct benchmark benchmarks[] = {
+	{"tokenize_short", bench_tokenize_short},
+	{"tokenize_long", bench_tokenize_long},
+	{"index_of", bench_index_of},
+	{"substr", bench_substr},
+	{"concat", bench_concat},
+	{"lex_short", bench_lex_short},
+	{"lex_long", bench_lex_long},
+	{"lex_many_redirects", bench_lex_many_redirects},
+	{"parse_short", bench_parse_short},
+	{"parse_many_args", bench_parse_many_args},
+	{"parse_many_redirects", bench_parse_many_redirects},
+	{"variable_assignment_10k", bench_variable_assignment},
+	{"var_get_10k", bench_var_get},
+	{"expand_variable_10k", bench_expand_variable}
+};
+
+
+// Command substitution is not benchmarked, expand.c only needs the function to link
+void execute_commands(char *line)
+{
+}
+
+// Usage: ucysh_microbench [-r rounds] [name ...]
+// Runs the benchmarks whose names start with one of the given names (all of them without names)
+int main(int argc, char **argv)
+{
+	int rounds = MICROBENCH_ROUNDS;
+	int first = 1;
+	if (argc > 2 && strcmp(argv[1], "-r") == 0)
+	{
+		rounds = atoi(argv[2]);
+		first = 3;
+	}
+	if (rounds < 1)
+	{
+		fprintf(stderr, "ucysh_microbench: -r needs a positive number of rounds\n");
+		return 1;
+	}
+	
+	if (make_inputs() < 0)
+	{
+		return 1;
+	}
+	
+	printf("%-26s%12s%12s%12s%12s%8s\n", "benchmark", "iterations", "min_ns", "median_ns", "max_ns", "mad%");
+	int i;
+	for (i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+	{
+		int selected = (first == argc);
+		int j;
+		for (j = first; j < argc && !selected; j++)
+		{
+			selected = (strncmp(benchmarks[i].name, argv[j], strlen(argv[j])) == 0);
+		}
+		if (selected)
+		{
+			measure(&benchmarks[i], rounds);
+		}
+	}
+	
+	return 0;
+}
+
+// Builds the synthetic input lines and the variable names
+int make_inputs(void)
+{
+	short_line = "ls -l --color=auto \"$HOME/My Documents\" /tmp";
+	
+	// Every input is smaller than 64 bytes per word
+	long_line = (char *) malloc(MICROBENCH_LONG_WORDS * 64);
+	args_line = (char *) malloc(MICROBENCH_MANY_ARGS * 64);
+	redirects_line = (char *) malloc(MICROBENCH_MANY_REDIRECTS * 64);
+	line_copy = (char *) malloc(MICROBENCH_LONG_WORDS * 64);
+	tokens = (char **) malloc((MICROBENCH_LONG_WORDS + 2) * sizeof(char *));
+	assignments = (char **) malloc(MICROBENCH_VARIABLES * sizeof(char *));
+	names = (char **) malloc(MICROBENCH_VARIABLES * sizeof(char *));
+	if (long_line == NULL || args_line == NULL || redirects_line == NULL || line_copy == NULL || tokens == NULL || assignments == NULL || names == NULL)
+	{
+		perror("malloc");
+		return -1;
+	}
+	
+	int i, length = sprintf(long_line, "echo");
+	for (i = 0; i < MICROBENCH_LONG_WORDS; i++)
+	{
+		length += sprintf(long_line + length, " word%d", i);
+	}
+	
+	// Plain, double quoted, single quoted and $variable words in turn
+	length = sprintf(args_line, "cmd");
+	for (i = 0; i < MICROBENCH_MANY_ARGS; i++)
+	{
+		switch (i % 4)
+		{
+			case 0: length += sprintf(args_line + length, " --option%d=value", i); break;
+			case 1: length += sprintf(args_line + length, " \"quoted argument %d\"", i); break;
+			case 2: length += sprintf(args_line + length, " 'single %d'", i); break;
+			case 3: length += sprintf(args_line + length, " ${v%d}", i); break;
+		}
+	}
+	
+	length = sprintf(redirects_line, "cmd arg");
+	for (i = 0; i < MICROBENCH_MANY_REDIRECTS; i++)
+	{
+		switch (i % 4)
+		{
+			case 0: length += sprintf(redirects_line + length, " < input%d", i); break;
+			case 1: length += sprintf(redirects_line + length, " > output%d", i); break;
+			case 2: length += sprintf(redirects_line + length, " 2>> errors%d", i); break;
+			case 3: length += sprintf(redirects_line + length, " 3>&1"); break;
+		}
+	}
+	
+	// The variables exist before every benchmark, so the parse benchmarks expand real values
+	for (i = 0; i < MICROBENCH_VARIABLES; i++)
+	{
+		char text[MICROBENCH_NAME_SIZE * 2];
+		sprintf(text, "v%d=value%d", i, i);
+		assignments[i] = strdup(text);
+		names[i] = strndup(text, strchr(text, '=') - text);
+		if (assignments[i] == NULL || names[i] == NULL || variable_assignment(assignments[i]) < 0)
+		{
+			perror("strdup");
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+// Copies a line into line_copy
+void copy_line(const char *line)
+{
+	memcpy(line_copy, line, strlen(line) + 1);
+}
+
+// Lexes line_copy into the arena, returns the number of tokens
+int lex_copy(const char *line, struct token **lexed)
+{
+	arena_reset(&bench_arena);
+	copy_line(line);
+	return lex_line(&bench_arena, line_copy, lexed);
+}
+
+// Runs a benchmark for "rounds" rounds and prints its statistics
+void measure(struct benchmark *benchmark, int rounds)
+{
+	// Doubles the iterations until one round is long enough (also warms up caches and the allocator)
+	long iterations = 1, i;
+	while (1)
+	{
+		unsigned long long start = stats_now();
+		for (i = 0; i < iterations; i++)
+		{
+			benchmark->run();
+		}
+		if (stats_now() - start >= MICROBENCH_ROUND_NS || iterations >= (1L << 30))
+		{
+			break;
+		}
+		iterations *= 2;
+	}
+	
+	double *per_iteration = (double *) malloc(rounds * sizeof(double));
+	double *deviations = (double *) malloc(rounds * sizeof(double));
+	if (per_iteration == NULL || deviations == NULL)
+	{
+		perror("malloc");
+		free(per_iteration);
+		free(deviations);
+		return;
+	}
+	
+	int round;
+	for (round = 0; round < rounds; round++)
+	{
+		unsigned long long start = stats_now();
+		for (i = 0; i < iterations; i++)
+		{
+			benchmark->run();
+		}
+		per_iteration[round] = (double) (stats_now() - start) / iterations;
+	}
+	
+	// Median and median absolute deviation are not moved by a round the scheduler interrupted
+	qsort(per_iteration, rounds, sizeof(double), compare_doubles);
+	double median = per_iteration[rounds / 2];
+	for (round = 0; round < rounds; round++)
+	{
+		deviations[round] = (per_iteration[round] > median) ? per_iteration[round] - median : median - per_iteration[round];
+	}
+	qsort(deviations, rounds, sizeof(double), compare_doubles);
+	
+	printf("%-26s%12ld%12.1f%12.1f%12.1f%8.1f\n", benchmark->name, iterations, per_iteration[0], median, per_iteration[rounds - 1], deviations[rounds / 2] * 100 / median);
+	fflush(stdout);
+	
+	free(per_iteration);
+	free(deviations);
+}
+
+// Compares two doubles for qsort
+int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+// Tokenizes the short line and frees the tokens
+void bench_tokenize_short(void)
+{
+	copy_line(short_line);
+	int count = tokenize(line_copy, " \n", tokens), i;
+	for (i = 0; i < count; i++)
+	{
+		free(tokens[i]);
+	}
+	sink += count;
+}
+
+// Tokenizes the long line and frees the tokens
+void bench_tokenize_long(void)
+{
+	copy_line(long_line);
+	int count = tokenize(line_copy, " \n", tokens), i;
+	for (i = 0; i < count; i++)
+	{
+		free(tokens[i]);
+	}
+	sink += count;
+}
+
+// Looks for the last word of the long line
+void bench_index_of(void)
+{
+	static int ready = 0;
+	if (!ready)
+	{
+		copy_line(long_line);
+		tokenize(line_copy, " \n", tokens); // Kept for every later run
+		ready = 1;
+	}
+	sink += index_of(tokens, tokens[MICROBENCH_LONG_WORDS]);
+}
+
+// Copies the long line without its first and last characters
+void bench_substr(void)
+{
+	char *result = substr(long_line, 1, strlen(long_line) - 1);
+	sink += result[0];
+	free(result);
+}
+
+// Joins MICROBENCH_MANY_ARGS words of the long line
+void bench_concat(void)
+{
+	bench_index_of(); // Makes sure the tokens exist
+	char *result = concat(tokens, ' ', 1, MICROBENCH_MANY_ARGS + 1);
+	sink += result[0];
+	free(result);
+}
+
+// Lexes the short line
+void bench_lex_short(void)
+{
+	struct token *lexed;
+	sink += lex_copy(short_line, &lexed);
+}
+
+// Lexes the long line
+void bench_lex_long(void)
+{
+	struct token *lexed;
+	sink += lex_copy(long_line, &lexed);
+}
+
+// Lexes the line with many redirections
+void bench_lex_many_redirects(void)
+{
+	struct token *lexed;
+	sink += lex_copy(redirects_line, &lexed);
+}
+
+// Lexes and parses the short line (arguments expanded, files not opened)
+void bench_parse_short(void)
+{
+	struct token *lexed;
+	struct command command;
+	int count = lex_copy(short_line, &lexed);
+	parse_command(&bench_arena, lexed, count, &command);
+	sink += command.argc;
+}
+
+// Lexes and parses the line with many quoted and $variable arguments
+void bench_parse_many_args(void)
+{
+	struct token *lexed;
+	struct command command;
+	int count = lex_copy(args_line, &lexed);
+	parse_command(&bench_arena, lexed, count, &command);
+	sink += command.argc;
+}
+
+// Lexes and parses the line with many redirections
+void bench_parse_many_redirects(void)
+{
+	struct token *lexed;
+	struct command command;
+	int count = lex_copy(redirects_line, &lexed);
+	parse_command(&bench_arena, lexed, count, &command);
+	sink += command.argc;
+}
+
+// Assigns the next of the MICROBENCH_VARIABLES variables
+void bench_variable_assignment(void)
+{
+	sink += variable_assignment(assignments[next_variable]);
+	next_variable = (next_variable + 1) % MICROBENCH_VARIABLES;
+}
+
+// Looks up the next of the MICROBENCH_VARIABLES variables
+void bench_var_get(void)
+{
+	sink += var_get(names[next_variable])[0];
+	next_variable = (next_variable + 1) % MICROBENCH_VARIABLES;
+}
+
+// Expands a word with one of the MICROBENCH_VARIABLES variables in it
+void bench_expand_variable(void)
+{
+	static const char *words[] = {"${v17}/bin", "$v4242", "prefix-${v9999}-suffix", "\"$v0 and $v5000\""};
+	int drop;
+	arena_reset(&bench_arena);
+	char *expanded = expand_word(&bench_arena, words[next_variable % 4], &drop);
+	sink += expanded[0];
+	next_variable = (next_variable + 1) % MICROBENCH_VARIABLES;
+}
@@ -0,0 +1,66 @@
+#!/bin/sh
+###############################################
+# Built-in output syscall count test
+# Usage: output_syscalls.sh SHELL [VARIABLES]
+# Runs env, env | wc -l and an echo of 26 words
+# in SHELL with VARIABLES (default 2000)
+# exported variables and counts the write
+# syscalls each one costs the shell (syscw of
+# /proc/PID/io). Fails (exit status 1) if env
+# does more than one write per 10 lines of
+# output or the echo more than 5 writes
+###############################################
+SHELL_UNDER_TEST=$1
+VARIABLES=${2:-2000}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# The commands come from a script file, so no prompt is written between them
+sample="grep syscw /proc/\$\$/io >> $WORK/io"
+{
+	seq 1 "$VARIABLES" | awk '{ print "export V" $1 "=value" $1 }'
+	echo "$sample"
+	echo "$sample"
+	echo "env > /dev/null"
+	echo "$sample"
+	echo "env | wc -l > $WORK/lines"
+	echo "$sample"
+	echo "echo a b c d e f g h i j k l m n o p q r s t u v w x y z > /dev/null"
+	echo "$sample"
+} > "$WORK/script"
+
+"$SHELL_UNDER_TEST" "$WORK/script" > /dev/null 2>&1
+
+if [ "$(wc -l < "$WORK/io" 2>/dev/null)" != 5 ]
+then
+	echo "Missing syscw samples (no /proc/PID/io?)"
+	exit 1
+fi
+
+# Writes between two samples, less the writes of taking a sample alone
+set -- $(awk '{ print $2 }' "$WORK/io")
+base=$(($2 - $1))
+env_writes=$(($3 - $2 - base))
+piped_writes=$(($4 - $3 - base))
+echo_writes=$(($5 - $4 - base))
+lines=$(tr -d ' ' < "$WORK/lines")
+
+echo "env ($lines lines): $env_writes writes, env | wc -l: $piped_writes writes, echo of 26 words: $echo_writes writes"
+
+status=0
+for writes in $env_writes $piped_writes
+do
+	if [ $((writes * 10)) -gt "$lines" ]
+	then
+		echo "env does more than one write per 10 lines"
+		status=1
+	fi
+done
+if [ "$echo_writes" -gt 5 ]
+then
+	echo "echo does more than 5 writes"
+	status=1
+fi
+
+exit $status
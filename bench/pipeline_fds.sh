@@ -0,0 +1,81 @@
+#!/bin/sh
+###############################################
+# Long pipe sequence test
+# Usage: pipeline_fds.sh SHELL [STAGES] [MAX_FDS]
+# Runs a STAGES (default 200) stage cat pipe
+# sequence through SHELL and checks its output.
+# Every 50th stage and the last one report how
+# many descriptors the shell has open while the
+# sequence starts. Fails (exit status 1) if the
+# output is wrong or the peak is above MAX_FDS
+# (default 10): the shell must hold O(1) pipes.
+# Then runs the sequence with a missing command
+# in the middle: the other stages must still
+# run, $? must be the status of the last one and
+# the shell must not keep a descriptor of it
+###############################################
+SHELL_UNDER_TEST=$1
+STAGES=${2:-200}
+MAX_FDS=${3:-10}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# A probe stage counts the descriptors of its parent (the shell) and passes its input on
+probe="/bin/sh -c 'ls /proc/\$PPID/fd | wc -l >> $WORK/fds; exec cat'"
+awk -v n="$STAGES" -v probe="$probe" -v out="$WORK/out" 'BEGIN {
+	s = "seq 1 3"
+	for (i = 2; i <= n; i++)
+	{
+		s = s " | " ((i % 50 == 0 || i == n) ? probe : "cat")
+	}
+	print s " > " out
+}' > "$WORK/script"
+
+"$SHELL_UNDER_TEST" "$WORK/script" > /dev/null 2>&1
+
+status=0
+if [ "$(cat "$WORK/out" 2>/dev/null | tr '\n' ' ')" != "1 2 3 " ]
+then
+	echo "Wrong output of the $STAGES stage pipe sequence: $(cat "$WORK/out" 2>/dev/null | tr '\n' ' ')"
+	status=1
+fi
+
+# Same sequence with a missing middle command, the last one exits with 3
+# The shell's descriptors are counted before and after it by the same command
+count="/bin/sh -c 'ls /proc/\$PPID/fd | wc -l' >> $WORK/count"
+awk -v n="$STAGES" -v count="$count" -v out="$WORK/missing_out" -v status="$WORK/status" 'BEGIN {
+	s = "seq 1 3"
+	for (i = 2; i < n; i++)
+	{
+		s = s " | " ((i == int(n / 2)) ? "nosuchcommand_ucysh" : "cat")
+	}
+	print count
+	print s " | /bin/sh -c '\''cat > " out "; exit 3'\''; echo $? > " status
+	print count
+}' > "$WORK/missing"
+
+"$SHELL_UNDER_TEST" "$WORK/missing" > /dev/null 2>&1
+
+if [ "$(cat "$WORK/status" 2>/dev/null)" != 3 ] || [ -s "$WORK/missing_out" ] || [ ! -e "$WORK/missing_out" ]
+then
+	echo "Missing middle command: \$? $(cat "$WORK/status" 2>/dev/null) (expected 3 from the last command), output '$(cat "$WORK/missing_out" 2>/dev/null)' (expected empty)"
+	status=1
+fi
+set -- $(cat "$WORK/count" 2>/dev/null)
+echo "Missing middle command: shell descriptors before ${1:-none}, after ${2:-none}"
+if [ -z "$2" ] || [ "$1" != "$2" ]
+then
+	echo "The pipe sequence with a missing command leaked descriptors"
+	status=1
+fi
+
+peak=$(sort -n "$WORK/fds" 2>/dev/null | tail -1)
+echo "$STAGES stages: shell descriptors seen by the probes: $(tr '\n' ' ' < "$WORK/fds" 2>/dev/null) (peak ${peak:-none}, limit $MAX_FDS)"
+if [ -z "$peak" ] || [ "$peak" -gt "$MAX_FDS" ]
+then
+	echo "Peak open descriptors above $MAX_FDS"
+	status=1
+fi
+
+exit $status
@@ -0,0 +1,113 @@
+#!/bin/sh
+###############################################
+# End-to-end benchmarks of the shell
+# Usage: run.sh SHELL BASELINE THRESHOLD [update]
+# Each workload runs $BENCH_RUNS times (default 3),
+# the fastest run is reported
+# Runs each workload through SHELL (on stdin, like
+# an interactive session), prints commands/second,
+# p50/p99 line latency (from $UCYSH_STATS) and
+# peak RSS, then compares commands/second with
+# BASELINE: more than THRESHOLD percent slower
+# is a regression (exit status 1)
+# With "update" the results become the baseline
+# $BENCH_WORKLOADS runs only the listed workloads,
+# $BENCH_FORK_STORM sets the number of commands of
+# fork_storm (default 2000)
+###############################################
+SHELL_UNDER_TEST=$1
+BASELINE=$2
+THRESHOLD=${3:-20}
+UPDATE=$4
+RUNS=${BENCH_RUNS:-3}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Workload scripts: one command per line
+# fork_storm: external commands, spawn and wait cost
+seq 1 "${BENCH_FORK_STORM:-2000}" | awk '{ print "/bin/true" }' > "$WORK/fork_storm"
+# deep_pipelines: 16 stage pipe sequences
+seq 1 200 | awk '{ s = "/bin/echo " $1; for (i = 0; i < 15; i++) s = s " | /bin/cat"; print s " > /dev/null" }' > "$WORK/deep_pipelines"
+# assignments: variable table and expansion
+seq 1 50000 | awk '{ print "v" $1 "=value" $1 "; w=${v" $1 "}x$w_" $1 }' > "$WORK/assignments"
+# substitutions: x=$(echo ...), the built-in only substitutions that run without a fork
+seq 1 20000 | awk '{ print "x=$(echo hi" $1 ")" }' > "$WORK/substitutions"
+# large_output: env and history output of built-ins
+{
+	seq 1 2000 | awk '{ print "export V" $1 "=value" $1 }'
+	seq 1 200 | awk '{ print "env > /dev/null; history > /dev/null" }'
+} > "$WORK/large_output"
+# env_pipe: env output of 2000 variables piped into an external command (env | wc -l latency)
+{
+	seq 1 2000 | awk '{ print "export V" $1 "=value" $1 }'
+	seq 1 200 | awk '{ print "env | wc -l > /dev/null" }'
+} > "$WORK/env_pipe"
+# long_lines: lexing and expansion of lines with 2000 words
+seq 1 300 | awk '{ s = "echo"; for (i = 0; i < 2000; i++) s = s " word" i; print s " > /dev/null" }' > "$WORK/long_lines"
+
+WORKLOADS=${BENCH_WORKLOADS:-"fork_storm deep_pipelines assignments substitutions large_output env_pipe long_lines"}
+
+printf '%-16s%12s%12s%12s%12s%12s\n' workload commands/s p50_us p99_us rss_kb baseline
+status=0
+: > "$WORK/results"
+for workload in $WORKLOADS
+do
+	script="$WORK/$workload"
+	commands=$(wc -l < "$script")
+	
+	# Peak RSS of the shell itself, read by the shell at the end of the workload
+	echo 'grep VmHWM /proc/$$/status > '"$WORK/rss" >> "$script"
+	
+	# Fastest of the runs, the others are disturbed by the rest of the machine
+	rate=0
+	run=0
+	while [ $run -lt "$RUNS" ]
+	do
+		start=$(date +%s%N)
+		env -u HISTFILE UCYSH_STATS="$WORK/stats.json" HISTSIZE=100000 "$SHELL_UNDER_TEST" < "$script" > /dev/null 2>&1
+		end=$(date +%s%N)
+		run_rate=$(awk -v n="$commands" -v ns=$((end - start)) 'BEGIN { printf "%d", n / (ns / 1e9) }')
+		if [ "$run_rate" -gt "$rate" ]
+		then
+			rate=$run_rate
+			# Latency of one line from the "line" histogram of the shell's own statistics
+			p50=$(sed 's/.*"line": {[^}]*"p50": \([0-9]*\).*/\1/' "$WORK/stats.json" 2>/dev/null)
+			p99=$(sed 's/.*"line": {[^}]*"p99": \([0-9]*\).*/\1/' "$WORK/stats.json" 2>/dev/null)
+			rss=$(awk '{ print $2 }' "$WORK/rss" 2>/dev/null)
+		fi
+		run=$((run + 1))
+	done
+	
+	# Compare with the stored rate
+	base=$(awk -v w="$workload" '$1 == w { print $2 }' "$BASELINE" 2>/dev/null)
+	verdict=""
+	if [ -n "$base" ]
+	then
+		verdict=$(awk -v r="$rate" -v b="$base" -v t="$THRESHOLD" 'BEGIN { if (r < b * (1 - t / 100)) print "REGRESSION"; else printf "%+.1f%%", (r - b) * 100 / b }')
+		if [ "$verdict" = "REGRESSION" ]
+		then
+			status=1
+		fi
+	fi
+	
+	printf '%-16s%12s%12s%12s%12s%12s %s\n' "$workload" "$rate" \
+		"$(awk -v v="$p50" 'BEGIN { if (v == "") print "-"; else printf "%.1f", v / 1000 }')" \
+		"$(awk -v v="$p99" 'BEGIN { if (v == "") print "-"; else printf "%.1f", v / 1000 }')" "${rss:--}" "${base:--}" "$verdict"
+	echo "$workload $rate" >> "$WORK/results"
+done
+
+if [ "$UPDATE" = "update" ]
+then
+	{
+		echo "# Commands/second of each workload on the machine that last ran make bench-baseline"
+		cat "$WORK/results"
+	} > "$BASELINE"
+	echo "Baseline written to $BASELINE"
+	status=0
+elif [ $status -ne 0 ]
+then
+	echo "Slower than $BASELINE by more than $THRESHOLD%"
+fi
+
+exit $status
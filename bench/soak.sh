@@ -0,0 +1,104 @@
+#!/bin/sh
+###############################################
+# Memory soak test of the shell
+# Usage: soak.sh SHELL [COMMANDS] [MAX_GROWTH_KB]
+# Pipes COMMANDS (default 1000000) mixed commands
+# through SHELL and samples its RSS as it goes.
+# Fails (exit status 1) if the RSS grows more
+# than MAX_GROWTH_KB (default 1024) between the
+# end of the warm-up (first 10%) and the end, or
+# if the shell reports a sanitizer error (build
+# it with -fsanitize=address to check for leaks)
+###############################################
+SHELL_UNDER_TEST=$1
+COMMANDS=${2:-1000000}
+MAX_GROWTH_KB=${3:-1024}
+SAMPLES=20
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Built-ins, expansion, here-documents, pipes and a few external commands
+# Variable names repeat, so the steady state has a fixed number of variables
+awk -v n="$COMMANDS" -v samples="$SAMPLES" -v rss="$WORK/rss" 'BEGIN {
+	every = int(n / samples)
+	for (i = 1; i <= n; i++)
+	{
+		v = "v" (i % 64)
+		c = i % 20
+		if (i % every == 0) print "grep VmRSS /proc/$$/status >> " rss
+		else if (i % 1000 == 0) print "nosuchcommand " i
+		else if (i % 500 == 0) print "/bin/true &; wait"
+		else if (i % 200 == 0) print "/bin/true | /bin/cat"
+		else if (i % 5000 == 1) print "trace on; echo traced " i "; trace off; trace > /dev/null; trace clear"
+		else if (c == 0) print v "=value" i
+		else if (c == 1) print "echo $" v " \"quoted $" v "\" '\''single'\'' word" i
+		else if (c == 2) print "export E" (i % 32) "=value" i
+		else if (c == 3) print "unset " v
+		else if (c == 4) print "env"
+		else if (c == 5) print "read a b c <<< \"one two " i " four five\""
+		else if (c == 6) print "read -p \"prompt " i ": \" r s <<< \"answer " i "\""
+		else if (c == 7) print "echo $(echo substituted " i ") `echo " v "`"
+		else if (c == 8) print "echo a " i " | echo b"
+		else if (c == 9) print "history 3"
+		else if (c == 10) print "history -s value" (i % 100)
+		else if (c == 11) print "read h <<END\nhere " i " $" v "\nEND"
+		else if (c == 12) print "echo ${undefined:-default} ${" v "-other} $? 2>&1"
+		else if (c == 13) print "printenv 3>&1 3>&- > /dev/null"
+		else if (c == 14) print "time echo timed " i
+		else if (c == 15) print "stats"
+		else if (c == 16) print "hash; jobs"
+		else if (c == 17) print "cd /tmp; cd /"
+		else if (c == 18) print "readonly R" (i % 16)
+		else print "!!"
+	}
+}' > "$WORK/commands"
+
+# Posting lists of the history index emptied by compaction and indexed again (crashed the shell once)
+{
+	echo "echo a"
+	echo "history -s xyz"
+	seq 1 9 | awk '{ print "true" }'
+	echo "!ec"
+	echo "echo b"
+	echo "history -s xyz"
+} > "$WORK/history_index"
+env -u HISTFILE HISTSIZE=10 "$SHELL_UNDER_TEST" < "$WORK/history_index" > /dev/null 2>&1
+if [ $? -ge 128 ]
+then
+	echo "Shell crashed on the history index sequence"
+	exit 1
+fi
+
+start=$(date +%s)
+env HISTFILE="$WORK/history" HISTSIZE=1000 "$SHELL_UNDER_TEST" < "$WORK/commands" > /dev/null 2> "$WORK/stderr"
+end=$(date +%s)
+
+status=0
+if grep -q "Sanitizer" "$WORK/stderr"
+then
+	grep -A 30 "Sanitizer" "$WORK/stderr" | head -60
+	echo "Sanitizer errors"
+	status=1
+fi
+
+# RSS after the warm-up and at the end
+samples=$(wc -l < "$WORK/rss")
+if [ "$samples" -lt 3 ]
+then
+	echo "Only $samples RSS samples (the shell stopped early?)"
+	exit 1
+fi
+warm=$(awk 'NR == 2 { print $2 }' "$WORK/rss")
+last=$(awk 'END { print $2 }' "$WORK/rss")
+growth=$((last - warm))
+
+echo "RSS samples (KB):" $(awk '{ print $2 }' "$WORK/rss")
+echo "$COMMANDS commands in $((end - start)) s, RSS $warm KB after warm-up, $last KB at the end, growth $growth KB (limit $MAX_GROWTH_KB KB)"
+if [ "$growth" -gt "$MAX_GROWTH_KB" ]
+then
+	echo "RSS grew by more than $MAX_GROWTH_KB KB"
+	status=1
+fi
+
+exit $status
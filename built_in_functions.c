@@ -2,22 +2,19 @@
 
 // Globals
 
-char *history_commands[MAX_HISTORY_RECORDS] = {0};
-char *environment_variables[MAX_ENVIRONMENT_VARIABLES] = {0};
-int total_env = 0;
-char *local_variables[MAX_LOCAL_VARIABLES] = {0};
-char *local_variable_values[MAX_LOCAL_VARIABLES] = {0};
-int total_loc = 0;
+struct line_reader stdin_reader = {STDIN_FILENO};
+char **positional_params = NULL;
+int num_positional_params = 0;
 
-const char *built_in_commands[BUILT_IN_COMMANDS] = {"cd", "echo", "env", "printenv", "exec", "exit", "export", "history", "logout", "read", "unset"}; // Other built-in commands are already implemented
-int built_in_spawn_child[BUILT_IN_COMMANDS] = {0, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1};
-int (*built_in_functions[BUILT_IN_COMMANDS])(char **args) = {cd, echo, env, env, exec, exit_shell, export, history, exit_shell, read_input, export};
+const char *built_in_commands[BUILT_IN_COMMANDS] = {"cd", "echo", "env", "printenv", "exec", "exit", "export", "history", "logout", "read", "unset", "hash", "jobs", "fg", "bg", "wait", "readonly", "stats", "trace"}; // Other built-in commands are already implemented
+int (*built_in_functions[BUILT_IN_COMMANDS])(char **args, int out) = {cd, echo, env, env, exec, exit_shell, export, history, exit_shell, read_input, export, hash, list_jobs, fg, bg, wait_jobs, readonly, stats, trace};
+
+char **command_environment = NULL;
+int command_input = -1;
 
-int num_running_processes = 0;
 int num_forked_processes = 0;
 int pipe_failure = 0;
-int running_processes[MAX_RUNNING_PROCESSES] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
-int running_piped_commands[MAX_RUNNING_PROCESSES] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+int in_substitution = 0;
 
 // Functions
 
@@ -25,64 +22,13 @@ int running_piped_commands[MAX_RUNNING_PROCESSES] = {-1, -1, -1, -1, -1, -1, -1,
 int variable_assignment(char *expression)
 {
 	int index_eq = index_of_str(expression, '=');
-	char *var_name = substr(expression, 0, index_eq);
-	if (var_name == NULL)
+	if (index_eq <= 0)
 	{
 		return -1;
 	}
 	
-	if (index_eq == strlen(expression) - 1) // Clear variable
-	{
-		int index;
-		if ((index = index_of(local_variables, var_name)) >= 0)
-		{
-			free(local_variable_values[index]);
-			local_variable_values[index] = (char *) malloc(1);
-			local_variable_values[index][0] = '\0';
-		}
-		return 0;
-	}
-	
-	char *var_value;
-	if (expression[index_eq + 1] == '\"' || expression[index_eq + 1] == '\"') // If value contains quotes remove them
-	{
-		if (expression[strlen(expression) - 1] == '\"' || expression[strlen(expression) - 1] == '\"')
-		{
-			var_value = substr(expression, index_eq + 2, strlen(expression) - 1);
-		}
-		else
-		{
-			var_value = substr(expression, index_eq + 2, strlen(expression));
-		}
-	}
-	else
-	{
-		var_value = substr(expression, index_eq + 1, strlen(expression));
-	}
-	
-	if (var_value == NULL)
-	{
-		return -1;
-	}
-	
-	int index;
-	if ((index = index_of(local_variables, var_name)) >= 0) // If local variabe already declared
-	{
-		// Replace value
-		free(local_variable_values[index]);
-		local_variable_values[index] = (char *) malloc(strlen(var_value) + 1);
-		strcpy(local_variable_values[index], var_value);
-	}
-	else // Add variable definition
-	{
-		local_variables[total_loc] = (char *) malloc(strlen(var_name) + 1);
-		strcpy(local_variables[total_loc], var_name);
-		local_variable_values[total_loc] = (char *) malloc(strlen(var_value) + 1);
-		strcpy(local_variable_values[total_loc], var_value);
-		total_loc++;
-	}
-	
-	return 0;
+	// Quotes were already removed when the word was expanded
+	return var_setn(expression, index_eq, expression + index_eq + 1, 0);
 }
 
 // Check if command is built in
@@ -100,34 +46,26 @@ int is_built_in(char *command)
 	return -1;
 }
 
-// Executes built-in command
-int execute_built_in(char **args, int index)
+// Executes built-in command, writing its output to "out"
+int execute_built_in(char **args, int index, int out)
 {
 	if (index < 0 || index >= BUILT_IN_COMMANDS)
 	{
 		return -1;
 	}
 	
-	return built_in_functions[index](args);
-}
-
-// Kills processes with given pids
-void kill_processes(int *pids)
-{
-	int i;
-	for (i = 0; i < MAX_RUNNING_PROCESSES; i++)
-	{
-		if (pids[i] > 0)
-		{
-			kill(pids[i], SIGKILL);
-		}
-	}
+	stats_counters[STAT_BUILT_INS]++;
+	unsigned long long start = trace_enabled ? stats_now() : 0;
+	int result = built_in_functions[index](args, out);
+	out_flush(); // Whatever the built-in printed leaves in one write
+	trace_event("builtin", args[0], start, stats_now(), 0, result);
+	return result;
 }
 
 // Built in commands
 
 // Built-in cd command
-int cd(char **args)
+int cd(char **args, int out)
 {
 	if (args[1] == NULL)
 	{
@@ -144,225 +82,334 @@ int cd(char **args)
 }
 
 // Built-in echo command
-int echo(char **args)
+int echo(char **args, int out)
 {
+	// Variables and quotes were already handled when the arguments were expanded
 	int i = 1; // Skip echo arg
-	int ignore_variables = 0;
 	while (args[i] != NULL)
 	{
-		char *arg;
-		// Remove first quote
-		if (i == 1 && args[i][0] == '\'') // Ignore variables
-		{
-			arg = substr(args[i], 1, strlen(args[i]));
-			ignore_variables = 1;
-		}
-		else if (i == 1 && args[i][0] == '\"')
-		{	
-			arg = substr(args[i], 1, strlen(args[i]));
-		}
-		else
-		{
-			arg = args[i];
-		}
-		
-		if (args[i + 1] == NULL) // Remove last quote 
-		{
-			int len = strlen(arg) - 1;
-			if (arg[len] == '\"' || arg[len] == '\'')
-			{
-				arg = substr(arg, 0, len);
-			}
-		}
-		
-		int printed = 1;
-		if (arg[0] == '$' && !ignore_variables) // If arg is variable -> print value
-		{
-			char *var_name = substr(arg, 1, strlen(arg));
-			int index;
-		
-			if (strcmp(var_name, "RANDOM") == 0)
-			{
-				int rand_int = rand() % 32768;
-				char rand_str[5];
-				sprintf(rand_str, "%d", rand_int);
-				write(STDOUT_FILENO, rand_str, strlen(rand_str));
-			}	
-			else if (strcmp(var_name, "HOSTNAME") == 0)
-			{
-				char hostname[HOST_NAME_MAX + 1]; 
-				gethostname(hostname, HOST_NAME_MAX + 1);
-				write(STDOUT_FILENO, hostname, strlen(hostname));
-			}
-			else if ((index = index_of(environment_variables, var_name)) >= 0) // Environmental variable
-			{
-				char *value = getenv(var_name);
-				write(STDOUT_FILENO, value, strlen(value));
-				printed = 1;
-			}
-			else if ((index = index_of(local_variables, var_name)) >= 0) // Local variable
-			{
-				write(STDOUT_FILENO, local_variable_values[index], strlen(local_variable_values[index]));
-			}
-			else
-			{
-				printed = 0;
-			}
-		}
-		else // Print normal string
-		{
-			write(STDOUT_FILENO, arg, strlen(arg));
-		}
+		out_write(out, args[i], strlen(args[i]));
 		i++;
 		
-		if (args[i] != NULL && printed)
+		if (args[i] != NULL)
 		{
-			write(STDOUT_FILENO, " ", 1);
+			out_write(out, " ", 1);
 		}
 	}
-	write(STDOUT_FILENO, "\n", 1);
+	out_write(out, "\n", 1);
 	
 	return 0;
 }
 
 // Built-in env command
-int env(char **args)
+int env(char **args, int out)
 {
 	// print environment variables == export
-	int i = 0;
-	while (environment_variables[i] != NULL)
+	char **envp = (command_environment != NULL) ? command_environment : var_environment();
+	int i;
+	for (i = 0; envp[i] != NULL; i++)
 	{
-		char *env = getenv(environment_variables[i]);
-		if (env != NULL)
-		{
-			char *name_val = (char *) malloc(strlen(environment_variables[i]) + strlen(env) + 3);
-			sprintf(name_val, "%s=%s\n", environment_variables[i], env);
-			write(STDOUT_FILENO, name_val, strlen(name_val));
-		}
-		i++;
+		out_printf(out, "%s\n", envp[i]);
 	}
 	
 	return 0;
 }
 
 // Built-in exec command
-int exec(char **args)
+int exec(char **args, int out)
 {
-	if (execvp(args[1], args + 1) < 0)
+	if (args[1] == NULL)
 	{
-		perror("execvp");
-		return -1;
+		return 0;
 	}
 	
-	return 0;
+	out_flush();
+	line_reader_sync(&stdin_reader); // The new program continues reading where the shell stopped
+	
+	const char *path = path_lookup(args[1]);
+	char **envp = (command_environment != NULL) ? command_environment : var_environment();
+	if (path != NULL && execve(path, args + 1, envp) < 0 && errno == ENOEXEC)
+	{
+		// Executable without a #! line -> run it with /bin/sh, args[0] ("exec") makes room for the interpreter
+		args[0] = "/bin/sh";
+		args[1] = (char *) path;
+		execve("/bin/sh", args, envp);
+	}
+	perror("execve");
+	return -1;
 }
 
 // Built-in exit command
-int exit_shell(char **args)
+int exit_shell(char **args, int out)
 {	
 	int exit_code;
-	if (args[1] == NULL)
+	if (args[0] == NULL || args[1] == NULL) // Default -> status of the last command
 	{
-		exit_code = 0;
+		exit_code = last_exit_status;
 	}
 	else
 	{
 		exit_code = atoi(args[1]);
 	}
 	
-	// Free resources 
-	int i_args = 0;
-	while (args[i_args] != NULL)
-	{
-		free(args[i_args++]);
-	}
-	char **tmp = history_commands;
-	while(*tmp != NULL)
-	{
-		free(*tmp++);
-	}
-
-	tmp = environment_variables;
-	while(*tmp != NULL)
+	// A command substitution only leaves its copy of the shell: the jobs and exit handlers belong to the shell
+	if (in_substitution)
 	{
-		free(*tmp++);
+		out_flush();
+		fflush(stdout);
+		fflush(stderr);
+		_exit(exit_code);
 	}
 	
-	tmp = local_variables;
-	while(*tmp != NULL)
-	{
-		free(*tmp++);
-	}
-	
-	tmp = local_variable_values;
-	while(*tmp != NULL)
-	{
-		free(*tmp++);
-	}
+	// Free resources 
+	history_free();
+
+	var_clear();
 
 	// Kill running processes
-	kill_processes(running_processes);
+	jobs_kill_all(SIGKILL);
 	exit(exit_code);
 	return 0;
 }
 
 // Built-in export command
-int export(char **args)
+int export(char **args, int out)
 {
 	if (args[1] == NULL)
 	{
-		return env(args);
+		return env(args, out);
 	}
-	else
+	
+	int result = 0;
+	int i;
+	for (i = 1; args[i] != NULL; i++)
 	{
 		int index_eq;
-		if ((index_eq = index_of_str(args[1], '=')) >= 0)
+		if (strcmp(args[0], "unset") == 0)
 		{
-			char *name = substr(args[1], 0, index_eq);
-			
-			// Copy env variable so it is not lost after free
-			char *env_var = (char *) malloc(strlen(args[1]) + 1);
-			strcpy(env_var, args[1]);
-			
-			if (getenv(name) == NULL) // If variable does not exist
+			if (var_unset(args[i]) < 0)
 			{
-				// Add the variable
-				putenv(env_var);
-				
-				// Add to global also
-				environment_variables[total_env++] = name;
+				result = -1;
 			}
-			else
+		}
+		else if ((index_eq = index_of_str(args[i], '=')) > 0)
+		{
+			if (var_setn(args[i], index_eq, args[i] + index_eq + 1, VAR_EXPORTED) < 0)
 			{
-				putenv(env_var);
+				result = -1;
 			}
 		}
-		else if (strcmp(args[0], "unset") == 0)
+		else
 		{
-			return putenv(args[1]); // Delete variable
+			var_set_flags(args[i], VAR_EXPORTED); // Exporting an unset variable has no effect
 		}
 	}
 	
-	return 0;
+	return result;
+}
+
+// Built-in readonly command
+int readonly(char **args, int out)
+{
+	if (args[1] == NULL) // List readonly variables
+	{
+		int position = 0;
+		struct variable *var;
+		while ((var = var_next(&position)) != NULL)
+		{
+			if (var->flags & VAR_READONLY)
+			{
+				out_printf(out, "readonly %s=%s\n", var->name, var->value);
+			}
+		}
+		return 0;
+	}
+	
+	int result = 0;
+	int i;
+	for (i = 1; args[i] != NULL; i++)
+	{
+		int index_eq;
+		if ((index_eq = index_of_str(args[i], '=')) > 0)
+		{
+			if (var_setn(args[i], index_eq, args[i] + index_eq + 1, VAR_READONLY) < 0)
+			{
+				result = -1;
+			}
+		}
+		else if (var_set_flags(args[i], VAR_READONLY) < 0 && var_set(args[i], "", VAR_READONLY) < 0)
+		{
+			result = -1;
+		}
+	}
+	
+	return result;
+}
+
+// Built-in hash command
+int hash(char **args, int out)
+{
+	if (args[1] == NULL) // List cached commands
+	{
+		path_cache_print(out);
+		return 0;
+	}
+	
+	if (strcmp(args[1], "-r") == 0) // Forget all cached commands
+	{
+		path_cache_clear();
+		return 0;
+	}
+	
+	// Resolve and remember the given commands
+	int i, result = 0;
+	for (i = 1; args[i] != NULL; i++)
+	{
+		if (path_lookup(args[i]) == NULL)
+		{
+			fprintf(stderr, "hash: %s: not found\n", args[i]);
+			result = -1;
+		}
+	}
+	
+	return result;
 }
 
 // Built-in history command
-int history(char **args) // no args
+int history(char **args, int out)
 {
-	char **current_command = history_commands;
-	int line = 0;
-	char tmp[INPUT_BUF_SIZE];
-	while (*current_command != NULL)
+	long last = -1; // history N -> only the last N entries
+	if (args[1] != NULL && strcmp(args[1], "-s") == 0) // history -s pattern -> entries containing pattern
 	{
-		sprintf(tmp, "%d\t%s", line++, *current_command++);
-		write(STDOUT_FILENO, tmp, strlen(tmp));
+		if (args[2] == NULL)
+		{
+			fprintf(stderr, "history: -s: option requires an argument\n");
+			return 2;
+		}
+		
+		history_search(out, args[2]);
+		return 0;
 	}
+	else if (args[1] != NULL)
+	{
+		char *end;
+		last = strtol(args[1], &end, 10);
+		if (*end != '\0' || last < 0)
+		{
+			fprintf(stderr, "history: %s: numeric argument required\n", args[1]);
+			return 1;
+		}
+	}
+	
+	history_print(out, last);
+	return 0;
+}
+
+// Built-in jobs command
+int list_jobs(char **args, int out)
+{
+	sigset_t orig_mask;
+	block_sigchld(&orig_mask);
+	jobs_print(out);
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
 	
 	return 0;
 }
 
+// Built-in fg command
+int fg(char **args, int out)
+{
+	sigset_t orig_mask;
+	block_sigchld(&orig_mask);
+	
+	struct job *job = job_find(args[1]);
+	if (job == NULL)
+	{
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+		fprintf(stderr, "fg: %s: no such job\n", (args[1] != NULL) ? args[1] : "current");
+		return -1;
+	}
+	
+	out_printf(out, "%s\n", job->command);
+	out_flush(); // Shown before the job takes over the terminal
+	int status = job_run_foreground(job, 1, &orig_mask);
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+	
+	return status;
+}
+
+// Built-in bg command
+int bg(char **args, int out)
+{
+	sigset_t orig_mask;
+	block_sigchld(&orig_mask);
+	
+	struct job *job = job_find(args[1]);
+	if (job == NULL)
+	{
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+		fprintf(stderr, "bg: %s: no such job\n", (args[1] != NULL) ? args[1] : "current");
+		return -1;
+	}
+	
+	out_printf(out, "[%d]+ %s &\n", job->id, job->command);
+	job_run_background(job, 1);
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+	
+	return 0;
+}
+
+// Built-in wait command
+int wait_jobs(char **args, int out)
+{
+	sigset_t orig_mask;
+	block_sigchld(&orig_mask);
+	
+	int status = 0;
+	if (args[1] == NULL) // Wait for all background jobs
+	{
+		jobs_wait_all(&orig_mask);
+	}
+	else if (strcmp(args[1], "-n") == 0) // Wait for the next job to finish
+	{
+		status = jobs_wait_any(&orig_mask);
+	}
+	else // Wait for the given jobs, status is the one of the last
+	{
+		int i;
+		for (i = 1; args[i] != NULL; i++)
+		{
+			struct job *job = job_find(args[i]);
+			if (job == NULL)
+			{
+				// $! may already have been reported
+				if (args[i][0] == '%' || (status = jobs_last_bg_status(atoi(args[i]))) < 0)
+				{
+					fprintf(stderr, "wait: %s: no such job\n", args[i]);
+					status = 127;
+				}
+				continue;
+			}
+			
+			job_wait(job, &orig_mask);
+			if (job->num_running > 0) // Stopped
+			{
+				status = 128 + SIGTSTP;
+			}
+			else
+			{
+				status = job_status(job);
+				job_free(job);
+			}
+		}
+	}
+	
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+	return status;
+}
+
 // Built-in read command
-int read_input(char **args)
+int read_input(char **args, int out)
 {
 	if (args[1] == NULL)
 	{
@@ -410,8 +457,13 @@ int read_input(char **args)
 				}
 				
 				char *cat = concat(args, ' ', start, end);
+				if (cat == NULL)
+				{
+					return -1;
+				}
 				
 				message = substr(cat, 1, strlen(cat) - 1);
+				free(cat);
 			}
 		}
 		else
@@ -420,7 +472,12 @@ int read_input(char **args)
 			end = 3;
 		}
 		
+		if (message == NULL)
+		{
+			return -1;
+		}
 		printf("%s", message);
+		free(message);
 		
 		index = end;
 	}
@@ -429,24 +486,42 @@ int read_input(char **args)
 		index = 1;
 	}
 	
-	char input_buf[INPUT_BUF_SIZE];
+	fflush(stdout);
 	
 	// Get user input
-	if (fgets(input_buf, sizeof(input_buf), stdin) == NULL)
+	static char *input_buf = NULL; // Kept between calls, the line being executed is a different buffer
+	static size_t input_size = 0;
+	ssize_t input_length;
+	if (command_input != -1) // Redirected (e.g. read x <<< "$y") -> the shell's input is left alone
 	{
-		perror("fgets");
-		return -1;
+		struct line_reader reader = {command_input};
+		input_length = read_line(&reader, &input_buf, &input_size, NULL);
+		line_reader_free(&reader);
+	}
+	else
+	{
+		input_length = read_line(&stdin_reader, &input_buf, &input_size, NULL);
+	}
+	if (input_length < 0)
+	{
+		return 1; // End of input
 	}
 	
-	char *tokens[MAX_ARGS];
+	// Lines have no length limit -> at most one word per two characters
+	char **tokens = (char **) malloc((strlen(input_buf) / 2 + 2) * sizeof(char *));
+	if (tokens == NULL)
+	{
+		perror("malloc");
+		return -1;
+	}
 	int num_tokens;
 	if ((num_tokens = tokenize(input_buf, " \n", tokens)) < 0)
 	{
+		free_tokens(tokens); // The ones tokenized before malloc failed
 		fprintf(stderr, "Unable to tokenize variables\n");
 		return -1;
 	}
 	
-	char expression[INPUT_BUF_SIZE];
 	int i_token = 0;
 	
 	while (args[index] != NULL)
@@ -454,26 +529,83 @@ int read_input(char **args)
 		if (args[index + 1] == NULL) // If last variable
 		{
 			char *cat = concat(tokens, ' ', i_token, num_tokens); // Concat remaining tokens
-			sprintf(expression, "%s=%s", args[index], cat);
-			variable_assignment(expression);
+			var_set(args[index], (cat == NULL) ? "" : cat, 0);
+			free(cat);
 			
 			break;
 		}
 		
 		if (i_token < num_tokens) // Next variable = next token
 		{
-			sprintf(expression, "%s=%s", args[index], tokens[i_token]);
-			variable_assignment(expression);
+			var_set(args[index], tokens[i_token], 0);
 		}
 		else // Out of tokens
 		{
-			sprintf(expression, "%s=", args[index]);
-			variable_assignment(expression);
+			var_set(args[index], "", 0);
 		}
 		
 		i_token++;
 		index++;
 	}
+
+	free_tokens(tokens);
+	return 0;
+}
+
+// Built-in stats command
+int stats(char **args, int out)
+{
+	int json = 0, reset = 0, i;
+	for (i = 1; args[i] != NULL; i++)
+	{
+		if (strcmp(args[i], "-j") == 0) // Machine readable
+		{
+			json = 1;
+		}
+		else if (strcmp(args[i], "-r") == 0) // Start counting again
+		{
+			reset = 1;
+		}
+		else
+		{
+			fprintf(stderr, "stats: usage: stats [-j] [-r]\n");
+			return 2;
+		}
+	}
+	
+	if (reset)
+	{
+		stats_reset();
+		return 0;
+	}
+	
+	stats_print(out, json);
+	return 0;
+}
+
+// Built-in trace command
+int trace(char **args, int out)
+{
+	if (args[1] == NULL) // Print the trace
+	{
+		trace_print(out);
+	}
+	else if (strcmp(args[1], "on") == 0)
+	{
+		trace_enabled = 1;
+	}
+	else if (strcmp(args[1], "off") == 0)
+	{
+		trace_enabled = 0;
+	}
+	else if (strcmp(args[1], "clear") == 0)
+	{
+		trace_clear();
+	}
+	else if (trace_write(args[1]) < 0) // Write the trace to a file
+	{
+		return 1;
+	}
 	
 	return 0;
 }
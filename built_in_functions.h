@@ -9,14 +9,16 @@
 #include <signal.h>
 #include <limits.h>
 #include "helper_functions.h"
+#include "path_cache.h"
+#include "jobs.h"
+#include "variables.h"
+#include "line_reader.h"
+#include "history.h"
+#include "output.h"
 
 #define INPUT_BUF_SIZE 1024
-#define BUILT_IN_COMMANDS 11
-#define MAX_HISTORY_RECORDS 1024
-#define MAX_ENVIRONMENT_VARIABLES 128
-#define MAX_LOCAL_VARIABLES 128
+#define BUILT_IN_COMMANDS 19
 #define MAX_ARGS 64
-#define MAX_RUNNING_PROCESSES 10
 
 // Functions
 
@@ -26,53 +28,71 @@ int variable_assignment(char *expression);
 // Check if command is built in
 int is_built_in(char *command);
 
-// Executes built-in command
-int execute_built_in(char **args, int index);
-
-// Kills processes with given pids
-void kill_processes(int *pids);
+// Executes built-in command, writing its output to "out"
+int execute_built_in(char **args, int index, int out);
 
 // Built-in cd command
-int cd(char **args);
+int cd(char **args, int out);
 
 // Built-in echo command
-int echo(char **args);
+int echo(char **args, int out);
 
 // Built-in env command
-int env(char **args);
+int env(char **args, int out);
 
 // Built-in exec command
-int exec(char **args);
+int exec(char **args, int out);
 
 // Built-in exit command
-int exit_shell(char **args);
+int exit_shell(char **args, int out);
 
 // Built-in export command
-int export(char **args);
+int export(char **args, int out);
+
+// Built-in hash command
+int hash(char **args, int out);
 
 // Built-in history command
-int history(char **args);
+int history(char **args, int out);
+
+// Built-in jobs command
+int list_jobs(char **args, int out);
+
+// Built-in fg command
+int fg(char **args, int out);
+
+// Built-in bg command
+int bg(char **args, int out);
+
+// Built-in wait command
+int wait_jobs(char **args, int out);
 
 // Built-in read command
-int read_input(char **args);
+int read_input(char **args, int out);
+
+// Built-in readonly command
+int readonly(char **args, int out);
+
+// Built-in stats command
+int stats(char **args, int out);
+
+// Built-in trace command
+int trace(char **args, int out);
 
 
 // Globals
-extern char *history_commands[MAX_HISTORY_RECORDS]; // Stores current session history commands
-extern char *environment_variables[MAX_ENVIRONMENT_VARIABLES]; // Stores process environment variable names
-extern int total_env; // Total number of environment variables
-extern char *local_variables[MAX_LOCAL_VARIABLES]; // Stores process local variable names
-extern char *local_variable_values[MAX_LOCAL_VARIABLES]; // Stores process local variable values
-extern int total_loc; // Total number of local variables
+extern struct line_reader stdin_reader; // Shell input, shared by the prompt and the read command
+extern char **positional_params; // $0, $1, ... $n
+extern int num_positional_params; // Number of positional parameters including $0
 
 extern const char *built_in_commands[BUILT_IN_COMMANDS]; // Names of implemented built in commands
-extern int built_in_spawn_child[BUILT_IN_COMMANDS]; // 1 if built in command needs to fork()
-extern int (*built_in_functions[BUILT_IN_COMMANDS])(char **args); // Matching of built in command name to function
+extern int (*built_in_functions[BUILT_IN_COMMANDS])(char **args, int out); // Matching of built in command name to function
+
+extern int command_input; // Redirected input of the built-in being run, -1 = shell input
+extern char **command_environment; // Environment of the built-in being run with prefix assignments, NULL = exported variables
 
-extern int num_running_processes; // Total number of running processes
 extern int num_forked_processes; // Total number of forked processes in session
 extern int pipe_failure; // 1 if current pipe failed
-extern int running_processes[MAX_RUNNING_PROCESSES]; // Stores current running processes ids
-extern int running_piped_commands[MAX_RUNNING_PROCESSES]; // Stores current running piped commands ids
+extern int in_substitution; // 1 in the forked copy of the shell that runs a command substitution
 
 #endif
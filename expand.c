@@ -0,0 +1,707 @@
+#define _GNU_SOURCE
+#include "expand.h"
+
+#define EXPAND_SCRATCH_SIZE (HOST_NAME_MAX + 1) // Room for a number or the host name
+
+// Expanded text of the word being built, grows inside the arena
+struct expansion
+{
+	struct arena *arena;
+	char *data;
+	size_t length;
+	size_t size;
+	int split; // Unquoted expansion results are split into fields at blanks
+	int heredoc; // Quotes are ordinary characters (here-document body)
+	size_t *fields; // Offsets in data where a new field starts
+	int num_fields;
+	int max_fields;
+};
+
+int substitution_status = 0;
+
+static int reserve_chars(struct expansion *out, size_t n);
+static int expand_text(struct expansion *out, const char *p, const char *end, int *quoted, int *expanded);
+
+// Appends n characters to the expansion, moving it to a bigger arena buffer when full
+static int put_chars(struct expansion *out, const char *s, size_t n)
+{
+	if (reserve_chars(out, n) < 0)
+	{
+		return -1;
+	}
+	
+	memcpy(out->data + out->length, s, n);
+	out->length += n;
+	return 0;
+}
+
+// Removes blanks from the characters added since start, recording where each new field begins
+static int split_fields(struct expansion *out, size_t start)
+{
+	size_t read_pos, write_pos = start;
+	for (read_pos = start; read_pos < out->length; read_pos++)
+	{
+		char c = out->data[read_pos];
+		if (c != ' ' && c != '\t' && c != '\n')
+		{
+			out->data[write_pos++] = c;
+			continue;
+		}
+		
+		if (out->num_fields > 0 && out->fields[out->num_fields - 1] == write_pos) // Run of blanks
+		{
+			continue;
+		}
+		if (out->num_fields == out->max_fields)
+		{
+			int new_max = (out->max_fields == 0) ? 16 : out->max_fields * 2;
+			size_t *bigger = (size_t *) arena_alloc(out->arena, new_max * sizeof(size_t));
+			if (bigger == NULL)
+			{
+				return -1;
+			}
+			if (out->num_fields > 0)
+			{
+				memcpy(bigger, out->fields, out->num_fields * sizeof(size_t));
+			}
+			out->fields = bigger;
+			out->max_fields = new_max;
+		}
+		out->fields[out->num_fields++] = write_pos;
+	}
+	out->length = write_pos;
+	
+	return 0;
+}
+
+// Appends the result of an expansion, split into fields when it was not quoted
+static int put_value(struct expansion *out, const char *value, int unquoted)
+{
+	size_t start = out->length;
+	if (value == NULL || put_chars(out, value, strlen(value)) < 0)
+	{
+		return (value == NULL) ? 0 : -1;
+	}
+	
+	return (unquoted && out->split) ? split_fields(out, start) : 0;
+}
+
+// Returns the value of the parameter name (len characters), NULL if it is not set
+// Numbers and the host name are formatted into scratch (EXPAND_SCRATCH_SIZE bytes)
+static const char *parameter_value(const char *name, size_t len, char *scratch)
+{
+	if (len == 1)
+	{
+		switch (name[0])
+		{
+			case '?': // Exit status of the last command
+				snprintf(scratch, EXPAND_SCRATCH_SIZE, "%d", last_exit_status);
+				return scratch;
+			case '$': // Process id of the shell
+				snprintf(scratch, EXPAND_SCRATCH_SIZE, "%d", (int) getpid());
+				return scratch;
+			case '!': // Process id of the last background job
+				if (last_bg_pid <= 0)
+				{
+					return NULL;
+				}
+				snprintf(scratch, EXPAND_SCRATCH_SIZE, "%d", last_bg_pid);
+				return scratch;
+			case '#': // Number of positional parameters, $0 not included
+				snprintf(scratch, EXPAND_SCRATCH_SIZE, "%d", (num_positional_params > 0) ? num_positional_params - 1 : 0);
+				return scratch;
+		}
+	}
+	
+	if (name[0] >= '0' && name[0] <= '9') // Positional parameter
+	{
+		int position = atoi(name);
+		return (position < num_positional_params) ? positional_params[position] : NULL;
+	}
+	
+	if (len == 6 && strncmp(name, "RANDOM", 6) == 0) // Random value in range 0, 32767
+	{
+		snprintf(scratch, EXPAND_SCRATCH_SIZE, "%d", rand() % 32768);
+		return scratch;
+	}
+	
+	const char *value = var_getn(name, len);
+	if (value == NULL && len == 8 && strncmp(name, "HOSTNAME", 8) == 0) // Not inherited -> ask the system
+	{
+		if (gethostname(scratch, EXPAND_SCRATCH_SIZE) < 0)
+		{
+			return NULL;
+		}
+		scratch[EXPAND_SCRATCH_SIZE - 1] = '\0';
+		return scratch;
+	}
+	
+	return value;
+}
+
+// Returns the length of the parameter name at p: a variable name, digits in braces, one digit or a special character
+static size_t parameter_name_length(const char *p, const char *end, int braced)
+{
+	if (p >= end)
+	{
+		return 0;
+	}
+	
+	if (*p == '?' || *p == '$' || *p == '!' || *p == '#')
+	{
+		return 1;
+	}
+	
+	size_t len = 0;
+	if (*p >= '0' && *p <= '9')
+	{
+		if (!braced) // $10 is $1 followed by 0
+		{
+			return 1;
+		}
+		while (p + len < end && p[len] >= '0' && p[len] <= '9')
+		{
+			len++;
+		}
+		return len;
+	}
+	
+	if (isalpha((unsigned char) *p) || *p == '_')
+	{
+		while (p + len < end && (isalnum((unsigned char) p[len]) || p[len] == '_'))
+		{
+			len++;
+		}
+	}
+	
+	return len;
+}
+
+// Expands the parameter reference starting with the '$' at p, *next is set after it
+static int expand_parameter(struct expansion *out, const char *p, const char *end, const char **next, int unquoted)
+{
+	char scratch[EXPAND_SCRATCH_SIZE];
+	const char *value;
+	
+	if (p + 1 < end && p[1] == '{')
+	{
+		// Find the closing brace, braces of nested references included
+		const char *close = lex_group_end(p);
+		if (close == NULL || close > end)
+		{
+			close = end;
+		}
+		
+		const char *name = p + 2;
+		size_t len = parameter_name_length(name, close, 1);
+		const char *op = name + len;
+		if (close >= end || len == 0 || (op != close && *op != '-' && !(op[0] == ':' && op + 1 < close && op[1] == '-')))
+		{
+			fprintf(stderr, "%.*s: bad substitution\n", (int) (((close < end) ? close + 1 : end) - p), p);
+			return -1;
+		}
+		*next = close + 1;
+		
+		value = parameter_value(name, len, scratch);
+		if (op == close)
+		{
+			return put_value(out, value, unquoted);
+		}
+		
+		// ${VAR-default} when unset, ${VAR:-default} also when empty
+		int colon = (*op == ':');
+		if (value == NULL || (colon && value[0] == '\0'))
+		{
+			int quoted = 0, expanded = 0;
+			return expand_text(out, op + 1 + colon, close, &quoted, &expanded);
+		}
+		return put_value(out, value, unquoted);
+	}
+	
+	size_t len = parameter_name_length(p + 1, end, 0);
+	if (len == 0) // Lone '$' stays as it is
+	{
+		*next = p + 1;
+		return put_chars(out, "$", 1);
+	}
+	
+	*next = p + 1 + len;
+	value = parameter_value(p + 1, len, scratch);
+	return put_value(out, value, unquoted);
+}
+
+// Makes room for n more characters in the expansion
+static int reserve_chars(struct expansion *out, size_t n)
+{
+	if (out->length + n + 1 > out->size)
+	{
+		size_t new_size = out->size * 2;
+		while (out->length + n + 1 > new_size)
+		{
+			new_size *= 2;
+		}
+		
+		char *bigger = (char *) arena_alloc(out->arena, new_size);
+		if (bigger == NULL)
+		{
+			return -1;
+		}
+		memcpy(bigger, out->data, out->length);
+		out->data = bigger;
+		out->size = new_size;
+	}
+	
+	return 0;
+}
+
+// Checks if every command of line (length characters) is a built-in that changes nothing in the shell
+static int is_pure_line(struct arena *arena, const char *line, size_t length)
+{
+	static const char *pure[] = SUBSTITUTION_PURE_BUILT_INS;
+	
+	// Lexing changes the text -> a copy is checked
+	char *copy = arena_strndup(arena, line, length);
+	struct token *tokens;
+	int count;
+	if (copy == NULL || (count = lex_line(arena, copy, &tokens)) <= 0)
+	{
+		return 0;
+	}
+	
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		if (tokens[i].type == TOKEN_AMP)
+		{
+			return 0;
+		}
+		if (i > 0 && tokens[i - 1].type != TOKEN_SEMI && tokens[i - 1].type != TOKEN_PIPE)
+		{
+			continue;
+		}
+		if (tokens[i].type == TOKEN_SEMI)
+		{
+			continue;
+		}
+		
+		// First word of a command
+		int j = 0;
+		while (pure[j] != NULL && (tokens[i].type != TOKEN_WORD || strcmp(tokens[i].text, pure[j]) != 0))
+		{
+			j++;
+		}
+		if (pure[j] == NULL)
+		{
+			return 0;
+		}
+	}
+	
+	return 1;
+}
+
+// Runs the commands of line in a forked copy of the shell with its output on fd, returns their exit status (-1 if it could not start)
+static int run_in_child(char *line, int fd)
+{
+	sigset_t orig_mask;
+	block_sigchld(&orig_mask);
+	
+	struct job *job = job_create(line);
+	if (job == NULL)
+	{
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+		return -1;
+	}
+	
+	// Buffered output belongs to the shell, not to the copy, and read-ahead input goes back so the copy cannot give it back twice
+	line_reader_sync(&stdin_reader);
+	out_flush();
+	fflush(stdout);
+	fflush(stderr);
+	
+	int pid = fork();
+	if (pid < 0)
+	{
+		perror("fork");
+		job_free(job);
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+		return -1;
+	}
+	
+	if (pid == 0)
+	{
+		// The copy leads its own foreground group, its commands stay in it
+		in_substitution = 1;
+		if (shell_is_interactive)
+		{
+			setpgid(0, 0);
+			shell_is_interactive = 0;
+		}
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+		
+		if (dup2(fd, STDOUT_FILENO) < 0)
+		{
+			perror("dup2");
+			_exit(1);
+		}
+		execute_commands(line);
+		
+		// Exit handlers (statistics, trace files) belong to the shell
+		out_flush();
+		fflush(stdout);
+		fflush(stderr);
+		_exit(last_exit_status);
+	}
+	
+	job_add_process(job, pid, "substitution");
+	int status = job_run_foreground(job, 0, &orig_mask);
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+	
+	return status;
+}
+
+// Runs the commands in text (len characters) with their output captured and appends it without trailing newlines
+// Unquoted output is split into fields
+static int command_substitution(struct expansion *out, const char *text, size_t len, int backquoted, int unquoted)
+{
+	stats_counters[STAT_SUBSTITUTIONS]++;
+	
+	// Commands are lexed in place -> run a copy, in `...` a backslash escapes $, ` and backslash
+	char *line = (char *) arena_alloc(out->arena, len + 1);
+	if (line == NULL)
+	{
+		return -1;
+	}
+	size_t i, line_length = 0;
+	for (i = 0; i < len; i++)
+	{
+		if (backquoted && text[i] == '\\' && i + 1 < len && strchr("$`\\", text[i + 1]) != NULL)
+		{
+			i++;
+		}
+		line[line_length++] = text[i];
+	}
+	line[line_length] = '\0';
+	
+	// Output goes to memory: no reader is needed while the shell waits
+	int memfd = memfd_create("ucysh-substitution", MFD_CLOEXEC);
+	if (memfd < 0)
+	{
+		perror("memfd_create");
+		return -1;
+	}
+	
+	// Only built-ins that change nothing run in the shell, anything else (exit, cd, assignments) in a copy of it
+	if (is_pure_line(out->arena, line, line_length))
+	{
+		fflush(stdout);
+		int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+		if (saved_stdout < 0 || dup2(memfd, STDOUT_FILENO) < 0)
+		{
+			perror("dup2");
+			close(memfd);
+			if (saved_stdout >= 0)
+			{
+				close(saved_stdout);
+			}
+			return -1;
+		}
+		
+		execute_commands(line);
+		
+		fflush(stdout);
+		dup2(saved_stdout, STDOUT_FILENO);
+		close(saved_stdout);
+		substitution_status = last_exit_status;
+	}
+	else if ((substitution_status = run_in_child(line, memfd)) < 0)
+	{
+		close(memfd);
+		return -1;
+	}
+	
+	struct stat st;
+	if (fstat(memfd, &st) < 0 || reserve_chars(out, st.st_size) < 0)
+	{
+		close(memfd);
+		return -1;
+	}
+	
+	ssize_t n, total = 0;
+	while (total < st.st_size && (n = pread(memfd, out->data + out->length + total, st.st_size - total, total)) > 0)
+	{
+		total += n;
+	}
+	close(memfd);
+	
+	// Trailing newlines are removed like in sh
+	while (total > 0 && out->data[out->length + total - 1] == '\n')
+	{
+		total--;
+	}
+	size_t start = out->length;
+	out->length += total;
+	
+	return (unquoted && out->split) ? split_fields(out, start) : 0;
+}
+
+// Expands parameters in the text between p and end and removes quotes and escapes
+static int expand_text(struct expansion *out, const char *p, const char *end, int *quoted, int *expanded)
+{
+	char quote = 0;
+	while (p < end)
+	{
+		char c = *p;
+		int result;
+		
+		if (quote == '\'') // Everything literal until the closing quote
+		{
+			if (c != '\'' && put_chars(out, p, 1) < 0)
+			{
+				return -1;
+			}
+			quote = (c == '\'') ? 0 : quote;
+			p++;
+			continue;
+		}
+		
+		if (c == '\\')
+		{
+			// Inside "" a backslash only escapes $ ` " and \, in a here-document $ ` and \, elsewhere any character
+			const char *escapable = out->heredoc ? "$`\\" : "$`\"\\";
+			if (p + 1 < end && ((quote == 0 && !out->heredoc) || strchr(escapable, p[1]) != NULL))
+			{
+				p++;
+			}
+			result = put_chars(out, p, 1);
+			p++;
+		}
+		else if ((c == '\'' || c == '\"') && !out->heredoc)
+		{
+			result = 0;
+			if (quote == 0)
+			{
+				quote = c;
+				*quoted = 1;
+			}
+			else if (quote == c)
+			{
+				quote = 0;
+			}
+			else // ' inside ""
+			{
+				result = put_chars(out, p, 1);
+			}
+			p++;
+		}
+		else if ((c == '$' && p + 1 < end && p[1] == '(') || c == '`')
+		{
+			*expanded = 1;
+			const char *close = lex_group_end(p);
+			if (close == NULL || close >= end)
+			{
+				fprintf(stderr, "Syntax error: unterminated %.2s\n", p);
+				return -1;
+			}
+			const char *text = p + ((c == '`') ? 1 : 2);
+			result = command_substitution(out, text, close - text, c == '`', quote == 0);
+			p = close + 1;
+		}
+		else if (c == '$')
+		{
+			*expanded = 1;
+			result = expand_parameter(out, p, end, &p, quote == 0);
+		}
+		else
+		{
+			result = put_chars(out, p, 1);
+			p++;
+		}
+		
+		if (result < 0)
+		{
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+// Starts the expansion of word in a buffer of the arena
+static int expansion_init(struct expansion *out, struct arena *arena, const char *word, int split)
+{
+	out->arena = arena;
+	out->length = 0;
+	out->size = strlen(word) + 1;
+	out->split = split;
+	out->heredoc = 0;
+	out->fields = NULL;
+	out->num_fields = 0;
+	out->max_fields = 0;
+	
+	out->data = (char *) arena_alloc(arena, out->size);
+	return (out->data == NULL) ? -1 : 0;
+}
+
+// Expands parameters in a word and removes its quotes and escapes, the result is allocated from the arena
+char *expand_word(struct arena *arena, const char *word, int *drop)
+{
+	// Words without anything to expand or remove are used as they are
+	*drop = 0;
+	if (strpbrk(word, "$`\'\"\\") == NULL)
+	{
+		return (char *) word;
+	}
+	
+	struct expansion out;
+	int quoted = 0, expanded = 0;
+	if (expansion_init(&out, arena, word, 0) < 0 || expand_text(&out, word, word + strlen(word), &quoted, &expanded) < 0)
+	{
+		return NULL;
+	}
+	out.data[out.length] = '\0';
+	
+	*drop = (!quoted && expanded && out.length == 0);
+	return out.data;
+}
+
+// Expands parameters and command substitutions in a here-document body, quotes are kept
+char *expand_here_document(struct arena *arena, const char *body)
+{
+	if (strpbrk(body, "$`\\") == NULL)
+	{
+		return (char *) body;
+	}
+	
+	struct expansion out;
+	int quoted = 0, expanded = 0;
+	if (expansion_init(&out, arena, body, 0) < 0)
+	{
+		return NULL;
+	}
+	out.heredoc = 1;
+	if (expand_text(&out, body, body + strlen(body), &quoted, &expanded) < 0)
+	{
+		return NULL;
+	}
+	out.data[out.length] = '\0';
+	
+	return out.data;
+}
+
+// Expands the word of a here-string (not split into fields) and adds the newline that ends it
+char *expand_here_string(struct arena *arena, const char *word)
+{
+	int drop;
+	char *text = expand_word(arena, word, &drop);
+	if (text == NULL)
+	{
+		return NULL;
+	}
+	
+	size_t length = strlen(text);
+	char *line = (char *) arena_alloc(arena, length + 2);
+	if (line == NULL)
+	{
+		return NULL;
+	}
+	memcpy(line, text, length);
+	line[length] = '\n';
+	line[length + 1] = '\0';
+	
+	return line;
+}
+
+// Appends an argument to argv, doubling it inside the arena when full
+static int push_arg(struct arena *arena, char ***argv, int *argc, int *capacity, char *arg)
+{
+	if (*argc + 1 == *capacity) // Room for the NULL at the end
+	{
+		char **bigger = (char **) arena_alloc(arena, *capacity * 2 * sizeof(char *));
+		if (bigger == NULL)
+		{
+			return -1;
+		}
+		memcpy(bigger, *argv, *argc * sizeof(char *));
+		*argv = bigger;
+		*capacity *= 2;
+	}
+	
+	(*argv)[(*argc)++] = arg;
+	return 0;
+}
+
+// Builds a NULL terminated argument vector from "count" tokens, expanding every word
+char **expand_argv(struct arena *arena, struct token *tokens, int count, int *argc)
+{
+	int capacity = count + 1, n = 0;
+	char **argv = (char **) arena_alloc(arena, capacity * sizeof(char *));
+	if (argv == NULL)
+	{
+		return NULL;
+	}
+	
+	substitution_status = 0;
+	int assignments = 1; // Leading name=value words are not split into fields, like in sh
+	int declaration = 0; // Neither are the name=value arguments of export and readonly
+	
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		char *text = tokens[i].text;
+		int assignment = (assignments || declaration) && tokens[i].type == TOKEN_WORD && is_variable_assignment(text);
+		if (assignments && !assignment) // Command name
+		{
+			declaration = tokens[i].type == TOKEN_WORD && (strcmp(text, "export") == 0 || strcmp(text, "readonly") == 0);
+		}
+		assignments = assignments && assignment;
+		
+		// Operators and words without anything to expand are used as they are
+		if (tokens[i].type != TOKEN_WORD || strpbrk(text, "$`\'\"\\") == NULL)
+		{
+			if (push_arg(arena, &argv, &n, &capacity, text) < 0)
+			{
+				return NULL;
+			}
+			continue;
+		}
+		
+		struct expansion out;
+		int quoted = 0, expanded = 0;
+		if (expansion_init(&out, arena, text, !(assignments || (declaration && assignment))) < 0 || expand_text(&out, text, text + strlen(text), &quoted, &expanded) < 0)
+		{
+			return NULL;
+		}
+		out.data[out.length] = '\0';
+		
+		if (out.num_fields == 0)
+		{
+			// Unquoted word that expanded to nothing is removed
+			if ((quoted || !expanded || out.length > 0) && push_arg(arena, &argv, &n, &capacity, out.data) < 0)
+			{
+				return NULL;
+			}
+			continue;
+		}
+		
+		// One argument per field, empty fields (blanks at either end) are left out
+		size_t field_start = 0;
+		int f;
+		for (f = 0; f <= out.num_fields; f++)
+		{
+			size_t field_end = (f < out.num_fields) ? out.fields[f] : out.length;
+			if (field_end > field_start)
+			{
+				char *field = arena_strndup(arena, out.data + field_start, field_end - field_start);
+				if (field == NULL || push_arg(arena, &argv, &n, &capacity, field) < 0)
+				{
+					return NULL;
+				}
+			}
+			field_start = field_end;
+		}
+	}
+	argv[n] = NULL;
+	
+	*argc = n;
+	return argv;
+}
@@ -0,0 +1,42 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#define SUBSTITUTION_PURE_BUILT_INS {"echo", "printenv", "env", "history", "jobs", NULL} // Run inside the shell, they change nothing
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "lexer.h"
+#include "variables.h"
+#include "built_in_functions.h"
+
+// Executes every command of a line without releasing the line arena (ucysh.c, runs command substitutions)
+void execute_commands(char *line);
+
+// Expands $VAR, ${VAR}, ${VAR:-default}, ${VAR-default}, the specials ($?, $$, $!, $#, $0..$9, $RANDOM, $HOSTNAME)
+// and command substitutions ($(...) and `...`) in a word and removes its quotes and escapes, the result is allocated from the arena
+// Sets *drop when the word was unquoted and expanded to nothing (it is removed from the command like in sh)
+// Returns NULL on a bad substitution or if out of memory
+char *expand_word(struct arena *arena, const char *word, int *drop);
+
+// Expands parameters and command substitutions in a here-document body (quotes are kept), allocated from the arena
+char *expand_here_document(struct arena *arena, const char *body);
+
+// Expands the word of a here-string (not split into fields) and adds the newline that ends it
+char *expand_here_string(struct arena *arena, const char *word);
+
+// Builds a NULL terminated argument vector from "count" tokens, expanding every word (operators are kept as they are)
+// Unquoted expansion results are split into separate arguments at blanks, except in leading assignments
+// and in the name=value arguments of export and readonly
+char **expand_argv(struct arena *arena, struct token *tokens, int count, int *argc);
+
+// Globals
+extern int substitution_status; // Exit status of the last command substitution of the command being expanded
+
+#endif
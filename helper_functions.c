@@ -1,88 +1,5 @@
 #include "helper_functions.h"
 
-// Parses arguments
-int parse_args(char **args, int argc, char **input, char **output, int *bg)
-{
-	int i_index = index_of(args, "<");
-	int o_index = index_of(args, ">");
-	int bg_index = index_of(args, "&");
-	
-	// Check for bg/fg option
-	if (bg_index < 0) 
-	{
-		*bg = 0; // Run in foreground
-	}
-	else 
-	{
-		if (bg_index != argc - 1)
-		{
-			// Error: & must be the last argument
-			return -1;
-		}
-		
-		*bg = 1; // Run in background
-		free(args[bg_index]); args[bg_index] = NULL; // Free data
-	}
-	
-	// Check for input redirection
-	if (i_index < 0)
-	{
-		*input = NULL;
-	}
-	else
-	{
-		if (i_index == 0 || i_index == argc - 1)
-		{
-			// Error
-			return -1;
-		}
-		
-		*input = (char *) malloc(strlen(args[i_index + 1]) + 1);
-		strcpy(*input, args[i_index + 1]);
-		
-		free(args[i_index]); args[i_index] = NULL; // Free data
-		free(args[i_index + 1]); args[i_index + 1] = NULL; // Free data
-	}
-	
-	// Check for output redirection
-	if (o_index < 0)
-	{
-		*output = NULL;
-	}
-	else
-	{
-		if (o_index == 0 || o_index == argc - 1)
-		{
-			// Error
-			return -1;
-		}
-		
-		*output = (char *) malloc(strlen(args[o_index + 1]) + 1);
-		strcpy(*output, args[o_index + 1]);
-		
-		free(args[o_index]); args[o_index] = NULL; // Free data
-		free(args[o_index + 1]); args[o_index + 1] = NULL; // Free data
-	}
-	
-	// Rearrange args so that all non NULL arguments are in the beginning
-	int i, non_null_pos = 0;
-	for (i = 0; i < argc; i++)
-	{
-		if (args[i] != NULL)
-		{
-			if (i != non_null_pos)
-			{
-				char *tmp = args[i];
-				args[i] = args[non_null_pos];
-				args[non_null_pos] = tmp; 
-			}
-			non_null_pos++;
-		}
-	}
-	
-	return non_null_pos; // Number of remaining arguments
-}
-
 // Checks if "tokens" has a token = "value" and return index
 int index_of(char **tokens, const char *value)
 {
@@ -117,11 +34,19 @@ int index_of_str(char *expression, char c)
 // Checks if expression is a variable assignment
 int is_variable_assignment(char *expression)
 {
-	if (index_of_str(expression, '=') >= 0)
+	// Name must be a valid identifier: letter or '_' followed by letters, digits or '_'
+	if (!isalpha((unsigned char) expression[0]) && expression[0] != '_')
 	{
-		return 1;
+		return 0;
 	}
-	return 0;
+	
+	int i = 1;
+	while (isalnum((unsigned char) expression[i]) || expression[i] == '_')
+	{
+		i++;
+	}
+	
+	return expression[i] == '=';
 }
 
 // Concatenates arguments from start to end to a single string and splits by delimiter
@@ -136,6 +61,11 @@ char *concat(char **args, char delimiter, int start, int end)
 		i++;
 	}
 	
+	if (total_size == 0) // Empty range -> empty string
+	{
+		total_size = 1;
+	}
+	
 	char *result = (char *) malloc(total_size);
 	if (result == NULL)
 	{
@@ -181,6 +111,18 @@ char *substr(char *string, int start, int end)
 	return str;
 }
 
+// Hashes a string (djb2)
+unsigned int hash_string(const char *string)
+{
+	unsigned int hash = 5381;
+	while (*string != '\0')
+	{
+		hash = hash * 33 + (unsigned char) *string++;
+	}
+	
+	return hash;
+}
+
 // Tokenize string "buf" into "tokens" based on "delimeters"
 int tokenize(char *buf, const char *delimiters, char **tokens)
 {
@@ -194,7 +136,7 @@ int tokenize(char *buf, const char *delimiters, char **tokens)
 		if (tokens[i] == NULL)
 		{
 			perror("malloc");
-			return -1;
+			return -1; // tokens[i] = NULL ends the ones stored so far
 		}
 		
 		strcpy(tokens[i++], token);
@@ -206,3 +148,14 @@ int tokenize(char *buf, const char *delimiters, char **tokens)
 	tokens[i] = NULL;
 	return i; // Return number of tokens
 }
+
+// Frees the tokens stored by tokenize and the array itself
+void free_tokens(char **tokens)
+{
+	int i;
+	for (i = 0; tokens[i] != NULL; i++)
+	{
+		free(tokens[i]);
+	}
+	free(tokens);
+}
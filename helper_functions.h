@@ -5,9 +5,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-
-// Parses arguments
-int parse_args(char **args, int argc, char **input, char **output, int *bg);
+#include <ctype.h>
 
 // Checks if "tokens" has a token = "value" and return index
 int index_of(char **tokens, const char *value);
@@ -15,7 +13,7 @@ int index_of(char **tokens, const char *value);
 // Checks if "expression" contains character 'c' and return index 
 int index_of_str(char *expression, char c);
 
-// Checks if expression is a variable assignment
+// Checks if expression is a variable assignment (name=value)
 int is_variable_assignment(char *expression);
 
 // Concatenates arguments to a single string and splits by delimiter
@@ -24,7 +22,13 @@ char *concat(char **args, char delimiter, int start, int end);
 // Returns a substring in a given range
 char *substr(char *string, int start, int end);
 
+// Hashes a string (djb2)
+unsigned int hash_string(const char *string);
+
 // Tokenize string "buf" into "tokens" based on "delimeters"
 int tokenize(char *buf, const char *delimiter, char **tokens);
 
+// Frees the tokens stored by tokenize and the array itself
+void free_tokens(char **tokens);
+
 #endif
@@ -0,0 +1,632 @@
+#define _GNU_SOURCE
+#include "history.h"
+
+static struct history_entry *entries = NULL; // Ring buffer of the newest entries
+static long capacity = 0; // Size of the ring ($HISTSIZE)
+static long first = 0; // Slot of the oldest entry
+static long count = 0; // Entries in the ring
+static long total = 0; // Entries ever added, numbers the entries
+
+// Posting list of a trigram: numbers of the entries containing it, oldest first
+struct trigram
+{
+	unsigned int key; // Three bytes of text, a leading '\0' marks the start of a line
+	unsigned int *numbers;
+	unsigned int start; // Numbers before start belong to entries that left the ring
+	unsigned int length;
+	unsigned int size; // 0 = free slot
+};
+
+static struct trigram *trigrams = NULL; // Search index (open addressing), built on the first search
+static unsigned int num_trigram_slots = 0;
+static unsigned int num_trigrams = 0;
+static long indexed = 0; // Entries with a number below this are in the index
+static long index_oldest = 0; // Oldest entry of the ring when the index was built
+
+static int history_fd = -1; // History file, opened with O_APPEND
+static char *map = NULL; // History file as it was at startup
+static size_t map_length = 0;
+
+// Frees the text of an entry unless it lives in the mapped file
+static void free_entry(struct history_entry *entry)
+{
+	if (!entry->mapped)
+	{
+		free(entry->text);
+	}
+}
+
+// Returns $HISTSIZE, HISTORY_DEFAULT_SIZE if it is not set or not a number
+static long history_size(void)
+{
+	const char *value = var_get("HISTSIZE");
+	if (value == NULL || *value == '\0')
+	{
+		return HISTORY_DEFAULT_SIZE;
+	}
+	
+	char *end;
+	long size = strtol(value, &end, 10);
+	return (*end != '\0' || size < 0) ? HISTORY_DEFAULT_SIZE : size;
+}
+
+// Rebuilds the ring with room for size entries, keeping the newest ones
+static int resize(long size)
+{
+	struct history_entry *new_entries = NULL;
+	if (size > 0 && (new_entries = (struct history_entry *) malloc(size * sizeof(struct history_entry))) == NULL)
+	{
+		perror("malloc");
+		return -1;
+	}
+	
+	// Entries that no longer fit are the oldest ones
+	long i, keep = (count < size) ? count : size;
+	for (i = 0; i < count - keep; i++)
+	{
+		free_entry(&entries[(first + i) % capacity]);
+	}
+	for (i = 0; i < keep; i++)
+	{
+		new_entries[i] = entries[(first + count - keep + i) % capacity];
+	}
+	
+	free(entries);
+	entries = new_entries;
+	capacity = size;
+	first = 0;
+	count = keep;
+	return 0;
+}
+
+// Puts an entry after the newest one, replacing the oldest when the ring is full
+static void push_entry(char *text, size_t length, int mapped)
+{
+	total++;
+	if (capacity == 0)
+	{
+		if (!mapped)
+		{
+			free(text);
+		}
+		return;
+	}
+	
+	struct history_entry *entry;
+	if (count == capacity)
+	{
+		entry = &entries[first];
+		free_entry(entry);
+		first = (first + 1) % capacity;
+	}
+	else
+	{
+		entry = &entries[(first + count++) % capacity];
+	}
+	
+	entry->text = text;
+	entry->length = length;
+	entry->mapped = mapped;
+}
+
+// Returns the entry with the given number, NULL if it is no longer (or not yet) in the ring
+static struct history_entry *entry_at(long number)
+{
+	long oldest = total - count;
+	if (number < oldest || number >= total)
+	{
+		return NULL;
+	}
+	
+	return &entries[(first + number - oldest) % capacity];
+}
+
+// Finds the slot of a trigram, or the free slot where it belongs
+static struct trigram *find_trigram(unsigned int key)
+{
+	unsigned int slot = (key * 2654435761u) & (num_trigram_slots - 1);
+	while (trigrams[slot].size != 0 && trigrams[slot].key != key)
+	{
+		slot = (slot + 1) & (num_trigram_slots - 1);
+	}
+	
+	return &trigrams[slot];
+}
+
+// Doubles the trigram table once it is half full
+static int grow_trigrams(void)
+{
+	unsigned int old_slots = num_trigram_slots;
+	struct trigram *old_trigrams = trigrams;
+	
+	num_trigram_slots = (old_slots == 0) ? HISTORY_INITIAL_TRIGRAMS : old_slots * 2;
+	if ((trigrams = (struct trigram *) calloc(num_trigram_slots, sizeof(struct trigram))) == NULL)
+	{
+		perror("calloc");
+		trigrams = old_trigrams;
+		num_trigram_slots = old_slots;
+		return -1;
+	}
+	
+	unsigned int i;
+	for (i = 0; i < old_slots; i++)
+	{
+		if (old_trigrams[i].size != 0)
+		{
+			*find_trigram(old_trigrams[i].key) = old_trigrams[i];
+		}
+	}
+	
+	free(old_trigrams);
+	return 0;
+}
+
+// Adds entry number to the posting list of key (once per entry)
+static int index_trigram(unsigned int key, unsigned int number)
+{
+	if (2 * (num_trigrams + 1) > num_trigram_slots && grow_trigrams() < 0)
+	{
+		return -1;
+	}
+	
+	struct trigram *trigram = find_trigram(key);
+	if (trigram->size == 0)
+	{
+		trigram->key = key;
+		num_trigrams++;
+	}
+	else if (trigram->length > 0 && trigram->numbers[trigram->length - 1] == number) // Trigram seen before in the same entry (the list may be empty after compaction)
+	{
+		return 0;
+	}
+	
+	if (trigram->length == trigram->size)
+	{
+		unsigned int new_size = (trigram->size == 0) ? 4 : trigram->size * 2;
+		unsigned int *numbers = (unsigned int *) realloc(trigram->numbers, new_size * sizeof(unsigned int));
+		if (numbers == NULL)
+		{
+			perror("realloc");
+			return -1;
+		}
+		trigram->numbers = numbers;
+		trigram->size = new_size;
+	}
+	
+	trigram->numbers[trigram->length++] = number;
+	return 0;
+}
+
+// Frees the search index
+static void free_index(void)
+{
+	unsigned int i;
+	for (i = 0; i < num_trigram_slots; i++)
+	{
+		free(trigrams[i].numbers);
+	}
+	free(trigrams);
+	trigrams = NULL;
+	num_trigram_slots = num_trigrams = 0;
+	indexed = 0;
+}
+
+// Adds every entry of the ring that is not indexed yet to the trigram index
+static void update_index(void)
+{
+	// Once every entry of the last build left the ring the index starts over,
+	// lists of trigrams nobody types any more would keep their memory otherwise
+	if (trigrams != NULL && total - count >= index_oldest + capacity)
+	{
+		free_index();
+	}
+	if (trigrams == NULL)
+	{
+		index_oldest = total - count;
+	}
+	
+	if (indexed < total - count)
+	{
+		indexed = total - count;
+	}
+	
+	for (; indexed < total; indexed++)
+	{
+		struct history_entry *entry = entry_at(indexed);
+		const unsigned char *text = (const unsigned char *) entry->text;
+		
+		// Start of the line, for prefix lookups
+		if (entry->length >= 2 && index_trigram((text[0] << 8) | text[1], indexed) < 0)
+		{
+			return;
+		}
+		
+		size_t i;
+		for (i = 0; i + 2 < entry->length; i++)
+		{
+			if (index_trigram((text[i] << 16) | (text[i + 1] << 8) | text[i + 2], indexed) < 0)
+			{
+				return;
+			}
+		}
+	}
+}
+
+// Returns the posting list of key without the entries that left the ring, NULL if no entry contains it
+static struct trigram *lookup_trigram(unsigned int key)
+{
+	if (num_trigram_slots == 0)
+	{
+		return NULL;
+	}
+	
+	struct trigram *trigram = find_trigram(key);
+	if (trigram->size == 0)
+	{
+		return NULL;
+	}
+	
+	// Drop numbers of evicted entries, compacting once they fill half the list
+	while (trigram->start < trigram->length && trigram->numbers[trigram->start] < total - count)
+	{
+		trigram->start++;
+	}
+	if (trigram->start > trigram->length / 2)
+	{
+		memmove(trigram->numbers, trigram->numbers + trigram->start, (trigram->length - trigram->start) * sizeof(unsigned int));
+		trigram->length -= trigram->start;
+		trigram->start = 0;
+	}
+	
+	return (trigram->start < trigram->length) ? trigram : NULL;
+}
+
+// Parses the records of the mapping from offset start on, a torn or damaged record is skipped up to the next newline
+static void load_records(size_t start)
+{
+	size_t position = start;
+	while (position < map_length)
+	{
+		// Record is ":length:text\n"
+		size_t length = 0, text = position + 1;
+		while (text < map_length && map[text] >= '0' && map[text] <= '9')
+		{
+			length = length * 10 + (map[text++] - '0');
+		}
+		
+		if (map[position] == ':' && text > position + 1 && text < map_length && map[text] == ':' &&
+			length < map_length - text - 1 && map[text + 1 + length] == '\n')
+		{
+			push_entry(map + text + 1, length, 1);
+			position = text + 2 + length;
+			continue;
+		}
+		
+		char *newline = memchr(map + position, '\n', map_length - position);
+		position = (newline == NULL) ? map_length : (size_t) (newline - map) + 1;
+	}
+}
+
+// Opens the history file and maps it, only the last $HISTSIZE records are parsed
+void history_init(void)
+{
+	if (resize(history_size()) < 0)
+	{
+		return;
+	}
+	
+	// $HISTFILE or ~/.ucysh_history
+	char path[PATH_MAX];
+	const char *file = var_get("HISTFILE"), *home = var_get("HOME");
+	if (file == NULL && home != NULL && snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE_NAME) < (int) sizeof(path))
+	{
+		file = path;
+	}
+	if (file == NULL || *file == '\0')
+	{
+		return;
+	}
+	
+	if ((history_fd = open(file, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, HISTORY_FILE_MODE)) < 0)
+	{
+		perror(file);
+		return;
+	}
+	
+	struct stat st;
+	if (fstat(history_fd, &st) < 0 || st.st_size == 0)
+	{
+		return;
+	}
+	if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, history_fd, 0)) == MAP_FAILED)
+	{
+		perror("mmap");
+		map = NULL;
+		return;
+	}
+	map_length = st.st_size;
+	
+	// Torn last record (shell killed while writing) -> our records start on a line of their own
+	if (map[map_length - 1] != '\n' && write(history_fd, "\n", 1) < 0)
+	{
+		perror("history");
+	}
+	
+	// Walk back over capacity records, so startup does not depend on the size of the file
+	size_t start = map_length;
+	long records = 0;
+	while (start > 1 && records < capacity)
+	{
+		char *newline = memrchr(map, '\n', start - 1);
+		start = (newline == NULL) ? 0 : (size_t) (newline - map) + 1;
+		records++;
+	}
+	if (records < capacity)
+	{
+		start = 0;
+	}
+	
+	load_records(start);
+}
+
+// Adds a line to the history and appends it to the history file
+int history_add(const char *line)
+{
+	if (line[strspn(line, " \t")] == '\0') // Nothing but blanks
+	{
+		return 0;
+	}
+	
+	long size = history_size();
+	if (size != capacity && resize(size) < 0)
+	{
+		return -1;
+	}
+	
+	size_t length = strlen(line);
+	char *text = strdup(line);
+	if (text == NULL)
+	{
+		perror("strdup");
+		return -1;
+	}
+	push_entry(text, length, 0);
+	
+	if (history_fd < 0)
+	{
+		return 0;
+	}
+	
+	// One writev on an O_APPEND descriptor -> records of concurrent shells never interleave
+	char header[32];
+	struct iovec record[3];
+	record[0].iov_base = header;
+	record[0].iov_len = snprintf(header, sizeof(header), ":%zu:", length);
+	record[1].iov_base = (void *) line;
+	record[1].iov_len = length;
+	record[2].iov_base = "\n";
+	record[2].iov_len = 1;
+	
+	if (writev(history_fd, record, 3) < 0)
+	{
+		perror("history");
+		return -1;
+	}
+	
+	return 0;
+}
+
+// Prints the last "last" entries with their numbers
+void history_print(int out, long last)
+{
+	long size = history_size();
+	if (size != capacity)
+	{
+		resize(size);
+	}
+	
+	long i = (last < 0 || last > count) ? 0 : count - last;
+	for (; i < count; i++)
+	{
+		struct history_entry *entry = &entries[(first + i) % capacity];
+		out_printf(out, "%ld\t%.*s\n", total - count + i, (int) entry->length, entry->text);
+	}
+}
+
+// Prints every entry containing pattern with its number
+void history_search(int out, const char *pattern)
+{
+	size_t length = strlen(pattern);
+	long number = total - count;
+	
+	// Candidates come from the rarest trigram of the pattern, each one is checked with memmem
+	struct trigram *rarest = NULL;
+	if (length >= 3)
+	{
+		update_index();
+		
+		size_t i;
+		for (i = 0; i + 2 < length; i++)
+		{
+			const unsigned char *p = (const unsigned char *) pattern + i;
+			struct trigram *trigram = lookup_trigram((p[0] << 16) | (p[1] << 8) | p[2]);
+			if (trigram == NULL)
+			{
+				return; // Some part of the pattern appears nowhere
+			}
+			if (rarest == NULL || trigram->length - trigram->start < rarest->length - rarest->start)
+			{
+				rarest = trigram;
+			}
+		}
+	}
+	
+	unsigned int i = (rarest != NULL) ? rarest->start : 0;
+	while (1)
+	{
+		if (rarest != NULL)
+		{
+			if (i == rarest->length)
+			{
+				break;
+			}
+			number = rarest->numbers[i++];
+		}
+		else if (number == total) // Short pattern -> every entry
+		{
+			break;
+		}
+		
+		struct history_entry *entry = entry_at(number++);
+		if (memmem(entry->text, entry->length, pattern, length) != NULL)
+		{
+			out_printf(out, "%ld\t%.*s\n", number - 1, (int) entry->length, entry->text);
+		}
+	}
+}
+
+// Returns the newest entry starting with the first length characters of prefix, NULL if there is none
+struct history_entry *history_find_prefix(const char *prefix, size_t length)
+{
+	if (count == 0)
+	{
+		return NULL;
+	}
+	if (length == 0)
+	{
+		return entry_at(total - 1);
+	}
+	
+	const unsigned char *p = (const unsigned char *) prefix;
+	struct trigram *trigram = NULL;
+	if (length >= 2)
+	{
+		update_index();
+		if ((trigram = lookup_trigram((p[0] << 8) | p[1])) == NULL)
+		{
+			return NULL;
+		}
+	}
+	
+	// Newest first: down the posting list of the start of the line, or every entry for a single character
+	long i = (trigram != NULL) ? trigram->length : total;
+	long end = (trigram != NULL) ? trigram->start : total - count;
+	while (i-- > end)
+	{
+		struct history_entry *entry = entry_at((trigram != NULL) ? trigram->numbers[i] : i);
+		if (entry->length >= length && memcmp(entry->text, prefix, length) == 0)
+		{
+			return entry;
+		}
+	}
+	
+	return NULL;
+}
+
+// Replaces !! and !prefix in *line with the newest matching history entry
+int history_expand(char **line, size_t *line_size)
+{
+	if (strchr(*line, '!') == NULL)
+	{
+		return 0;
+	}
+	
+	size_t length = 0, size = strlen(*line) + 1;
+	char *expanded = (char *) malloc(size);
+	if (expanded == NULL)
+	{
+		perror("malloc");
+		return -1;
+	}
+	
+	const char *p = *line;
+	int single_quoted = 0, double_quoted = 0, changed = 0;
+	while (*p != '\0')
+	{
+		const char *text = p;
+		size_t text_length = 1, consumed = 1;
+		
+		if (*p == '\'' && !double_quoted)
+		{
+			single_quoted = !single_quoted;
+		}
+		else if (*p == '"' && !single_quoted)
+		{
+			double_quoted = !double_quoted;
+		}
+		else if (*p == '\\' && p[1] != '\0') // \! stays a !
+		{
+			text_length = consumed = 2;
+		}
+		else if (*p == '!' && !single_quoted && (p == *line || p[-1] != '$') && p[1] != '\0' && strchr(HISTORY_WORD_END "=", p[1]) == NULL)
+		{
+			// !! is the previous line, !prefix the newest line starting with prefix
+			size_t prefix_length = (p[1] == '!') ? 0 : strcspn(p + 1, HISTORY_WORD_END);
+			consumed = (p[1] == '!') ? 2 : prefix_length + 1;
+			
+			struct history_entry *entry = history_find_prefix(p + 1, prefix_length);
+			if (entry == NULL)
+			{
+				fprintf(stderr, "%.*s: event not found\n", (int) consumed, p);
+				free(expanded);
+				return -1;
+			}
+			text = entry->text;
+			text_length = entry->length;
+			changed = 1;
+		}
+		
+		if (length + text_length + 1 > size)
+		{
+			size = 2 * (length + text_length + 1);
+			char *bigger = (char *) realloc(expanded, size);
+			if (bigger == NULL)
+			{
+				perror("realloc");
+				free(expanded);
+				return -1;
+			}
+			expanded = bigger;
+		}
+		memcpy(expanded + length, text, text_length);
+		length += text_length;
+		p += consumed;
+	}
+	expanded[length] = '\0';
+	
+	if (!changed)
+	{
+		free(expanded);
+		return 0;
+	}
+	
+	free(*line);
+	*line = expanded;
+	*line_size = size;
+	return 1;
+}
+
+// Frees the history entries and unmaps the history file
+void history_free(void)
+{
+	long i;
+	for (i = 0; i < count; i++)
+	{
+		free_entry(&entries[(first + i) % capacity]);
+	}
+	free(entries);
+	entries = NULL;
+	capacity = count = first = 0;
+	free_index();
+	
+	if (map != NULL)
+	{
+		munmap(map, map_length);
+		map = NULL;
+	}
+	if (history_fd >= 0)
+	{
+		close(history_fd);
+		history_fd = -1;
+	}
+}
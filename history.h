@@ -0,0 +1,55 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "variables.h"
+#include "output.h"
+
+#define HISTORY_DEFAULT_SIZE 1000 // Entries kept in memory when $HISTSIZE is not set
+#define HISTORY_FILE_NAME ".ucysh_history" // In $HOME, unless $HISTFILE names another file
+#define HISTORY_FILE_MODE 0600
+#define HISTORY_INITIAL_TRIGRAMS 1024 // Slots of the search index when it is first built
+#define HISTORY_WORD_END " \t;|&<>()'\"" // Characters that end the prefix of !prefix
+
+// A history line, either copied or pointing into the mapped history file (not NUL terminated then)
+struct history_entry
+{
+	char *text;
+	size_t length;
+	int mapped; // 1 if text points into the history file mapping
+};
+
+// Opens the history file (records of ":length:text\n" appended with O_APPEND, shared by every running shell)
+// and maps it, only the last $HISTSIZE records are parsed
+void history_init(void);
+
+// Adds a line to the history and appends it to the history file with a single write, empty lines are skipped
+int history_add(const char *line);
+
+// Prints the last "last" entries with their numbers (-1 = all of them)
+void history_print(int out, long last);
+
+// Prints every entry containing pattern with its number
+// Candidates come from a trigram index of the entries, built on the first search and extended as lines are added
+void history_search(int out, const char *pattern);
+
+// Returns the newest entry starting with the first length characters of prefix (length 0 = newest entry), NULL if there is none
+struct history_entry *history_find_prefix(const char *prefix, size_t length);
+
+// Replaces !! and !prefix in *line (not inside single quotes) with the newest matching history entry, *line is replaced by a new buffer
+// Returns 1 if the line changed, 0 if not, -1 if an event was not found
+int history_expand(char **line, size_t *line_size);
+
+// Frees the history entries and unmaps the history file
+void history_free(void);
+
+#endif
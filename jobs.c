@@ -0,0 +1,613 @@
+#include "jobs.h"
+
+int job_process_limit = 0;
+volatile sig_atomic_t num_running_processes = 0;
+int shell_is_interactive = 0;
+int shell_pgid = 0;
+int last_exit_status = 0;
+int last_bg_pid = -1;
+volatile long children_max_rss = 0;
+
+static struct process **pid_buckets = NULL; // pid -> process
+static int num_pid_buckets = 0;
+static int num_tracked = 0; // Processes currently in pid_buckets
+static struct job *first_job = NULL;
+static struct job *last_job = NULL;
+static int last_bg_status = -1; // Status of the last background job ($!) once it was freed
+
+// Reads the soft limit of running processes and, if interactive, takes control of the terminal
+void jobs_init(int interactive)
+{
+	char *limit = getenv("UCYSH_MAX_PROCESSES");
+	if (limit != NULL)
+	{
+		job_process_limit = atoi(limit);
+	}
+	
+	if ((pid_buckets = (struct process **) calloc(JOB_TABLE_INITIAL_BUCKETS, sizeof(struct process *))) == NULL)
+	{
+		perror("calloc");
+		exit(1);
+	}
+	num_pid_buckets = JOB_TABLE_INITIAL_BUCKETS;
+	
+	// Job control only when running on a terminal
+	shell_is_interactive = interactive && isatty(STDIN_FILENO);
+	shell_pgid = getpgrp();
+	if (!shell_is_interactive)
+	{
+		return;
+	}
+	
+	// Wait until the shell is in the foreground
+	while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp()))
+	{
+		kill(-shell_pgid, SIGTTIN);
+	}
+	
+	// Job control signals are meant for the foreground job, not the shell
+	signal(SIGQUIT, SIG_IGN);
+	signal(SIGTSTP, SIG_IGN);
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTTOU, SIG_IGN);
+	
+	// Put the shell in its own process group and take the terminal
+	shell_pgid = getpid();
+	if (getpgrp() != shell_pgid && setpgid(shell_pgid, shell_pgid) < 0)
+	{
+		perror("setpgid");
+	}
+	tcsetpgrp(STDIN_FILENO, shell_pgid);
+}
+
+// Checks if another "count" processes fit under the soft limit
+int jobs_can_start(int count)
+{
+	return job_process_limit <= 0 || num_running_processes + count <= job_process_limit;
+}
+
+// Finds the tracked process with the given pid, NULL if not tracked
+static struct process *find_process(int pid)
+{
+	struct process *process = pid_buckets[(unsigned int) pid & (num_pid_buckets - 1)];
+	while (process != NULL && process->pid != pid)
+	{
+		process = process->hash_next;
+	}
+	
+	return process;
+}
+
+// Unlinks a process from its pid bucket
+static void untrack_process(struct process *process)
+{
+	struct process **link = &pid_buckets[(unsigned int) process->pid & (num_pid_buckets - 1)];
+	while (*link != NULL)
+	{
+		if (*link == process)
+		{
+			*link = process->hash_next;
+			num_tracked--;
+			return;
+		}
+		link = &(*link)->hash_next;
+	}
+}
+
+// Doubles the pid buckets once the table gets crowded
+static void grow_pid_buckets(void)
+{
+	int new_size = num_pid_buckets * 2;
+	struct process **new_buckets = (struct process **) calloc(new_size, sizeof(struct process *));
+	if (new_buckets == NULL)
+	{
+		return; // Keep using the old (longer) chains
+	}
+	
+	int i;
+	for (i = 0; i < num_pid_buckets; i++)
+	{
+		struct process *process = pid_buckets[i];
+		while (process != NULL)
+		{
+			struct process *next = process->hash_next;
+			int slot = (unsigned int) process->pid & (new_size - 1);
+			process->hash_next = new_buckets[slot];
+			new_buckets[slot] = process;
+			process = next;
+		}
+	}
+	
+	free(pid_buckets);
+	pid_buckets = new_buckets;
+	num_pid_buckets = new_size;
+}
+
+// Blocks SIGCHLD so a child cannot be reaped before it is registered
+void block_sigchld(sigset_t *orig_mask)
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &mask, orig_mask) < 0)
+	{
+		perror("sigprocmask");
+	}
+}
+
+// Creates an empty job for the given command line
+struct job *job_create(const char *command)
+{
+	struct job *job = (struct job *) calloc(1, sizeof(struct job));
+	if (job == NULL)
+	{
+		perror("calloc");
+		return NULL;
+	}
+	
+	if ((job->command = strdup(command)) == NULL)
+	{
+		perror("strdup");
+		free(job);
+		return NULL;
+	}
+	
+	job->id = (last_job != NULL) ? last_job->id + 1 : 1; // Numbers are reused once the table empties
+	job->prev = last_job;
+	if (last_job != NULL)
+	{
+		last_job->next = job;
+	}
+	else
+	{
+		first_job = job;
+	}
+	last_job = job;
+	
+	return job;
+}
+
+// Adds a started process to a job and its process group (SIGCHLD must be blocked)
+int job_add_process(struct job *job, int pid, const char *name)
+{
+	// First process leads the group, set here too in case the child has not done it yet
+	if (shell_is_interactive)
+	{
+		if (job->pgid == 0)
+		{
+			job->pgid = pid;
+		}
+		setpgid(pid, job->pgid);
+	}
+	
+	struct process *process = (struct process *) calloc(1, sizeof(struct process));
+	if (process == NULL)
+	{
+		perror("calloc");
+		return -1;
+	}
+	
+	if (num_tracked >= num_pid_buckets)
+	{
+		grow_pid_buckets();
+	}
+	
+	process->pid = pid;
+	process->job = job;
+	process->start = stats_now();
+	strncpy(process->name, name, PROCESS_NAME_SIZE - 1);
+	
+	int slot = (unsigned int) pid & (num_pid_buckets - 1);
+	process->hash_next = pid_buckets[slot];
+	pid_buckets[slot] = process;
+	num_tracked++;
+	
+	if (job->last_process != NULL)
+	{
+		job->last_process->next = process;
+	}
+	else
+	{
+		job->processes = process;
+	}
+	job->last_process = process;
+	
+	job->num_processes++;
+	job->num_running++;
+	num_running_processes++;
+	
+	return 0;
+}
+
+// Sleeps until every process of the job is reaped or stopped (SIGCHLD must be blocked, orig_mask is the unblocked mask)
+void job_wait(struct job *job, sigset_t *orig_mask)
+{
+	// SIGCHLD is blocked here, so the check and the sleep cannot race with the handler
+	while (job->num_running > 0 && job->num_stopped < job->num_running)
+	{
+		sigsuspend(orig_mask);
+	}
+}
+
+// Marks a stopped job as running again and sends it SIGCONT (SIGCHLD must be blocked)
+static void job_continue(struct job *job)
+{
+	// Cleared here, so a late WCONTINUED report cannot make the job look stopped
+	struct process *process;
+	for (process = job->processes; process != NULL; process = process->next)
+	{
+		process->stopped = 0;
+	}
+	job->num_stopped = 0;
+	
+	job_kill(job, SIGCONT);
+}
+
+// Runs a job in the foreground (continuing it if "cont") and returns its exit status (SIGCHLD must be blocked)
+int job_run_foreground(struct job *job, int cont, sigset_t *orig_mask)
+{
+	job->bg = 0;
+	
+	if (shell_is_interactive && job->pgid > 0)
+	{
+		tcsetpgrp(STDIN_FILENO, job->pgid);
+	}
+	if (cont)
+	{
+		job_continue(job);
+	}
+	
+	unsigned long long wait_start = stats_now();
+	job_wait(job, orig_mask);
+	stats_record_since(HIST_WAIT, wait_start);
+	
+	if (shell_is_interactive)
+	{
+		tcsetpgrp(STDIN_FILENO, shell_pgid);
+	}
+	
+	if (job->num_running > 0) // Stopped -> keep it as a background job
+	{
+		job->bg = 1;
+		fprintf(stderr, "\n[%d]+  Stopped\t\t%s\n", job->id, job->command);
+		return 128 + SIGTSTP;
+	}
+	
+	int status = job_status(job);
+	job_free(job);
+	return status;
+}
+
+// Lets a job run in the background (continuing it if "cont")
+void job_run_background(struct job *job, int cont)
+{
+	job->bg = 1;
+	
+	if (job->last_process != NULL)
+	{
+		last_bg_pid = job->last_process->pid;
+		last_bg_status = -1;
+	}
+	
+	if (cont)
+	{
+		job_continue(job);
+	}
+	else if (shell_is_interactive)
+	{
+		fprintf(stderr, "[%d] %d\n", job->id, last_bg_pid);
+	}
+}
+
+// Returns the exit status of a finished job (status of its last process, 128 + signal if killed)
+int job_status(struct job *job)
+{
+	if (job->last_process == NULL)
+	{
+		return 0;
+	}
+	
+	int status = job->last_process->status;
+	if (WIFSIGNALED(status))
+	{
+		return 128 + WTERMSIG(status);
+	}
+	
+	return WEXITSTATUS(status);
+}
+
+// Sends a signal to every running process of the job
+void job_kill(struct job *job, int sig)
+{
+	if (job->pgid > 0)
+	{
+		kill(-job->pgid, sig);
+		return;
+	}
+	
+	struct process *process;
+	for (process = job->processes; process != NULL; process = process->next)
+	{
+		if (!process->done)
+		{
+			kill(process->pid, sig);
+		}
+	}
+}
+
+// Removes a job and frees its processes (SIGCHLD must be blocked)
+void job_free(struct job *job)
+{
+	// Keep the status of $! around for "wait $!"
+	if (job->last_process != NULL && job->last_process->pid == last_bg_pid && job->num_running == 0)
+	{
+		last_bg_status = job_status(job);
+	}
+	
+	struct process *process = job->processes;
+	while (process != NULL)
+	{
+		struct process *next = process->next;
+		if (!process->done) // Still running -> stop tracking it
+		{
+			untrack_process(process);
+			num_running_processes--;
+		}
+		else // Lifetime of the child, from posix_spawn until it was reaped
+		{
+			trace_event("process", process->name, process->start, process->end, process->pid,
+				WIFSIGNALED(process->status) ? 128 + WTERMSIG(process->status) : WEXITSTATUS(process->status));
+		}
+		free(process);
+		process = next;
+	}
+	
+	if (job->prev != NULL)
+	{
+		job->prev->next = job->next;
+	}
+	else
+	{
+		first_job = job->next;
+	}
+	
+	if (job->next != NULL)
+	{
+		job->next->prev = job->prev;
+	}
+	else
+	{
+		last_job = job->prev;
+	}
+	
+	free(job->command);
+	free(job);
+}
+
+// Finds a job by "%id", "%%", "%+" or process id, NULL if there is no such job
+struct job *job_find(const char *spec)
+{
+	if (spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0)
+	{
+		return job_current();
+	}
+	
+	struct job *job;
+	if (spec[0] == '%') // Job number
+	{
+		int id = atoi(spec + 1);
+		for (job = first_job; job != NULL; job = job->next)
+		{
+			if (job->id == id)
+			{
+				return job;
+			}
+		}
+		return NULL;
+	}
+	
+	// Process id of any process in the job
+	int pid = atoi(spec);
+	for (job = first_job; job != NULL; job = job->next)
+	{
+		struct process *process;
+		for (process = job->processes; process != NULL; process = process->next)
+		{
+			if (process->pid == pid)
+			{
+				return job;
+			}
+		}
+	}
+	
+	return NULL;
+}
+
+// Returns the most recently started background job, NULL if none
+struct job *job_current(void)
+{
+	struct job *job;
+	for (job = last_job; job != NULL; job = job->prev)
+	{
+		if (job->bg)
+		{
+			return job;
+		}
+	}
+	
+	return NULL;
+}
+
+// Returns a job state name
+static const char *job_state(struct job *job)
+{
+	if (job->num_running == 0)
+	{
+		return "Done";
+	}
+	if (job->num_stopped == job->num_running)
+	{
+		return "Stopped";
+	}
+	return "Running";
+}
+
+// Prints the job table
+void jobs_print(int out)
+{
+	struct job *current = job_current();
+	struct job *job;
+	for (job = first_job; job != NULL; job = job->next)
+	{
+		if (job->bg)
+		{
+			out_printf(out, "[%d]%c  %-24s%s\n", job->id, (job == current) ? '+' : ' ', job_state(job), job->command);
+		}
+	}
+}
+
+// Reports and frees finished background jobs (SIGCHLD must be blocked)
+void jobs_notify(void)
+{
+	struct job *job = first_job;
+	while (job != NULL)
+	{
+		struct job *next = job->next;
+		if (job->bg && job->num_running == 0)
+		{
+			if (shell_is_interactive)
+			{
+				fprintf(stderr, "[%d]+  Done\t\t\t%s\n", job->id, job->command);
+			}
+			job_free(job);
+		}
+		job = next;
+	}
+}
+
+// Waits for the next background job to finish and returns its status, 127 if none (SIGCHLD must be blocked)
+int jobs_wait_any(sigset_t *orig_mask)
+{
+	while (1)
+	{
+		int running = 0;
+		struct job *job;
+		for (job = first_job; job != NULL; job = job->next)
+		{
+			if (!job->bg)
+			{
+				continue;
+			}
+			
+			if (job->num_running == 0) // Finished -> report it
+			{
+				int status = job_status(job);
+				job_free(job);
+				return status;
+			}
+			
+			if (job->num_stopped < job->num_running)
+			{
+				running = 1;
+			}
+		}
+		
+		if (!running)
+		{
+			return 127;
+		}
+		sigsuspend(orig_mask);
+	}
+}
+
+// Waits for every background job to finish (SIGCHLD must be blocked)
+void jobs_wait_all(sigset_t *orig_mask)
+{
+	struct job *job = first_job;
+	while (job != NULL)
+	{
+		struct job *next = job->next;
+		if (job->bg)
+		{
+			job_wait(job, orig_mask);
+			if (job->num_running == 0)
+			{
+				job_free(job);
+			}
+		}
+		job = next;
+	}
+}
+
+// Returns the saved status of the last background job if pid is $! and it was already freed, -1 otherwise
+int jobs_last_bg_status(int pid)
+{
+	return (pid == last_bg_pid) ? last_bg_status : -1;
+}
+
+// Sends a signal to every running process of every job
+void jobs_kill_all(int sig)
+{
+	struct job *job;
+	for (job = first_job; job != NULL; job = job->next)
+	{
+		job_kill(job, sig);
+	}
+}
+
+// Reaps all terminated, stopped or continued children, called from the SIGCHLD handler
+void jobs_handle_sigchld(void)
+{
+	int saved_errno = errno;
+	int pid, status;
+	struct rusage usage;
+	while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0)
+	{
+		if ((WIFEXITED(status) || WIFSIGNALED(status)) && usage.ru_maxrss > children_max_rss)
+		{
+			children_max_rss = usage.ru_maxrss;
+		}
+		
+		struct process *process = find_process(pid);
+		if (process == NULL)
+		{
+			continue; // Not started by a job (e.g. already forgotten)
+		}
+		
+		if (WIFSTOPPED(status))
+		{
+			if (!process->stopped)
+			{
+				process->stopped = 1;
+				process->job->num_stopped++;
+			}
+			continue;
+		}
+		
+		if (WIFCONTINUED(status))
+		{
+			if (process->stopped)
+			{
+				process->stopped = 0;
+				process->job->num_stopped--;
+			}
+			continue;
+		}
+		
+		// Exited or killed: only unlink from the pid table, freeing is left to the main loop
+		untrack_process(process);
+		if (process->stopped)
+		{
+			process->stopped = 0;
+			process->job->num_stopped--;
+		}
+		
+		process->status = status;
+		process->usage = usage;
+		process->end = stats_now();
+		process->done = 1;
+		process->job->num_running--;
+		num_running_processes--;
+	}
+	errno = saved_errno;
+}
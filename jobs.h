@@ -0,0 +1,133 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
+
+#define JOB_TABLE_INITIAL_BUCKETS 64
+#define PROCESS_NAME_SIZE 32 // Start of the command name kept for the trace
+
+// A child process of the shell
+struct process
+{
+	int pid;
+	int status; // Status returned by wait4 once done
+	int done; // 1 after the child exited or was killed
+	int stopped; // 1 while the child is stopped (e.g. Ctrl-Z)
+	struct rusage usage; // Resources used, filled in by wait4 once done
+	unsigned long long start; // stats_now() when it was started
+	unsigned long long end; // stats_now() when it was reaped
+	char name[PROCESS_NAME_SIZE];
+	struct job *job; // Job this process belongs to
+	struct process *next; // Next process of the same job
+	struct process *hash_next; // Next process in the same pid bucket
+};
+
+// A command or pipe sequence started by the shell
+struct job
+{
+	int id; // Job number shown by jobs and used as %id
+	int pgid; // Process group of the job (0 without job control)
+	int bg; // 1 if the job runs in the background
+	char *command; // Command line that started the job
+	int num_processes; // Processes started for this job
+	int num_running; // Processes not yet reaped
+	int num_stopped; // Processes currently stopped
+	struct process *processes; // Processes in spawn order
+	struct process *last_process;
+	struct job *prev; // Job list links
+	struct job *next;
+};
+
+// Maximum number of running processes (0 = unlimited), read from $UCYSH_MAX_PROCESSES
+extern int job_process_limit;
+
+// Number of processes that have been started and not yet reaped
+extern volatile sig_atomic_t num_running_processes;
+
+// 1 if the shell runs on a terminal and does job control
+extern int shell_is_interactive;
+
+// Process group of the shell
+extern int shell_pgid;
+
+// Exit status of the last foreground command ($?)
+extern int last_exit_status;
+
+// Process id of the last background job ($!), -1 if none
+extern int last_bg_pid;
+
+// Largest peak resident set size (KB) of a child reaped since it was last reset (time)
+extern volatile long children_max_rss;
+
+// Reads the soft limit of running processes and, if interactive, takes control of the terminal
+void jobs_init(int interactive);
+
+// Checks if another "count" processes fit under the soft limit
+int jobs_can_start(int count);
+
+// Blocks SIGCHLD so a child cannot be reaped before it is registered
+void block_sigchld(sigset_t *orig_mask);
+
+// Creates an empty job for the given command line
+struct job *job_create(const char *command);
+
+// Adds a started process (running command name) to a job and its process group (SIGCHLD must be blocked)
+int job_add_process(struct job *job, int pid, const char *name);
+
+// Sleeps until every process of the job is reaped or stopped (SIGCHLD must be blocked, orig_mask is the unblocked mask)
+void job_wait(struct job *job, sigset_t *orig_mask);
+
+// Runs a job in the foreground (continuing it if "cont") and returns its exit status (SIGCHLD must be blocked)
+// The job is freed unless it was stopped, in which case it stays in the table as a background job
+int job_run_foreground(struct job *job, int cont, sigset_t *orig_mask);
+
+// Lets a job run in the background (continuing it if "cont")
+void job_run_background(struct job *job, int cont);
+
+// Returns the exit status of a finished job (status of its last process, 128 + signal if killed)
+int job_status(struct job *job);
+
+// Sends a signal to every running process of the job
+void job_kill(struct job *job, int sig);
+
+// Removes a job and frees its processes (SIGCHLD must be blocked)
+void job_free(struct job *job);
+
+// Finds a job by "%id", "%%", "%+" or process id, NULL if there is no such job
+struct job *job_find(const char *spec);
+
+// Returns the most recently started background job, NULL if none
+struct job *job_current(void);
+
+// Prints the job table
+void jobs_print(int out);
+
+// Reports and frees finished background jobs (SIGCHLD must be blocked)
+void jobs_notify(void);
+
+// Waits for the next background job to finish and returns its status, 127 if none (SIGCHLD must be blocked)
+int jobs_wait_any(sigset_t *orig_mask);
+
+// Waits for every background job to finish (SIGCHLD must be blocked)
+void jobs_wait_all(sigset_t *orig_mask);
+
+// Returns the saved status of the last background job if pid is $! and it was already freed, -1 otherwise
+int jobs_last_bg_status(int pid);
+
+// Sends a signal to every running process of every job
+void jobs_kill_all(int sig);
+
+// Reaps all terminated, stopped or continued children, called from the SIGCHLD handler
+void jobs_handle_sigchld(void);
+
+#endif
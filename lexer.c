@@ -0,0 +1,323 @@
+#include "lexer.h"
+
+// Appends a token, doubling the array inside the arena when full
+static int push_token(struct arena *arena, struct token **tokens, int *count, int *capacity, int type, char *text)
+{
+	if (*count == *capacity)
+	{
+		int new_capacity = (*capacity == 0) ? LEX_INITIAL_TOKENS : *capacity * 2;
+		struct token *bigger = (struct token *) arena_alloc(arena, new_capacity * sizeof(struct token));
+		if (bigger == NULL)
+		{
+			return -1;
+		}
+		if (*count > 0)
+		{
+			memcpy(bigger, *tokens, *count * sizeof(struct token));
+		}
+		*tokens = bigger;
+		*capacity = new_capacity;
+	}
+	
+	(*tokens)[*count].type = type;
+	(*tokens)[*count].text = text;
+	(*tokens)[*count].delimiter = NULL;
+	(*tokens)[*count].io_number = -1;
+	(*count)++;
+	return 0;
+}
+
+// Returns the operator token type starting with character c followed by next and next2 (and its spelling),
+// -1 if c is not an operator
+static int operator_type(char c, char next, char next2, char **text)
+{
+	switch (c)
+	{
+		case ';': case '\n': *text = ";"; return TOKEN_SEMI;
+		case '|': *text = "|"; return TOKEN_PIPE;
+		case '&':
+			if (next != '>')
+			{
+				*text = "&";
+				return TOKEN_AMP;
+			}
+			if (next2 == '>')
+			{
+				*text = "&>>";
+				return TOKEN_ANDDGREAT;
+			}
+			*text = "&>";
+			return TOKEN_ANDGREAT;
+		case '>':
+			if (next == '>')
+			{
+				*text = ">>";
+				return TOKEN_DGREAT;
+			}
+			if (next == '&')
+			{
+				*text = ">&";
+				return TOKEN_GREATAND;
+			}
+			*text = ">";
+			return TOKEN_GREAT;
+		case '<':
+			if (next == '&')
+			{
+				*text = "<&";
+				return TOKEN_LESSAND;
+			}
+			if (next != '<')
+			{
+				*text = "<";
+				return TOKEN_LESS;
+			}
+			if (next2 == '<')
+			{
+				*text = "<<<";
+				return TOKEN_TLESS;
+			}
+			if (next2 == '-')
+			{
+				*text = "<<-";
+				return TOKEN_DLESSDASH;
+			}
+			*text = "<<";
+			return TOKEN_DLESS;
+	}
+	
+	return -1;
+}
+
+// Checks if the word is a descriptor number written right before a redirection (the 2 of 2>file)
+static int is_io_number(const char *word, char next)
+{
+	if ((next != '<' && next != '>') || *word == '\0')
+	{
+		return 0;
+	}
+	
+	int length = 0;
+	while (word[length] >= '0' && word[length] <= '9')
+	{
+		length++;
+	}
+	
+	return word[length] == '\0' && length < 5;
+}
+
+// Returns the character closing the ${...}, $(...) or `...` group that starts at p, NULL if it is not closed
+const char *lex_group_end(const char *p)
+{
+	if (*p == '`')
+	{
+		for (p++; *p != '\0' && *p != '`'; p++)
+		{
+			if (*p == '\\' && p[1] != '\0')
+			{
+				p++;
+			}
+		}
+		return (*p == '`') ? p : NULL;
+	}
+	
+	char open = p[1];
+	char close = (open == '{') ? '}' : ')';
+	int depth = 0;
+	for (p++; *p != '\0'; p++)
+	{
+		if (*p == '\\' && p[1] != '\0')
+		{
+			p++;
+		}
+		else if (*p == '\'' || *p == '\"') // Quoted text may contain the closing character
+		{
+			char quote = *p;
+			for (p++; *p != '\0' && *p != quote; p++)
+			{
+				if (*p == '\\' && quote == '\"' && p[1] != '\0')
+				{
+					p++;
+				}
+			}
+			if (*p == '\0')
+			{
+				return NULL;
+			}
+		}
+		else if (*p == open)
+		{
+			depth++;
+		}
+		else if (*p == close && --depth == 0)
+		{
+			return p;
+		}
+	}
+	
+	return NULL;
+}
+
+// Splits "line" into tokens in a single pass, words are terminated in place inside "line"
+int lex_line(struct arena *arena, char *line, struct token **tokens)
+{
+	int count = 0, capacity = 0;
+	*tokens = NULL;
+	
+	char *p = line;
+	char c = *p;
+	while (c != '\0')
+	{
+		char *text;
+		int type;
+		
+		if (c == ' ' || c == '\t' || c == '\r') // Separators
+		{
+			c = *++p;
+			continue;
+		}
+		
+		if (c == '#') // Comment until the end of the line
+		{
+			break;
+		}
+		
+		if ((type = operator_type(c, p[1], (p[1] != '\0') ? p[2] : '\0', &text)) >= 0)
+		{
+			if (push_token(arena, tokens, &count, &capacity, type, text) < 0)
+			{
+				return -1;
+			}
+			p += strlen(text);
+			c = *p;
+			continue;
+		}
+		
+		// Word: runs until an unquoted separator or operator
+		char *word = p;
+		char quote = 0;
+		while (c != '\0')
+		{
+			if (quote != 0) // Inside quotes only the closing quote (or an escape or substitution in "") matters
+			{
+				if (c == '\\' && quote == '\"' && p[1] != '\0')
+				{
+					p++;
+				}
+				else if (quote == '\"' && ((c == '$' && (p[1] == '{' || p[1] == '(')) || c == '`'))
+				{
+					char *group_end = (char *) lex_group_end(p);
+					if (group_end == NULL)
+					{
+						fprintf(stderr, "Syntax error: unterminated %.2s\n", p);
+						return -1;
+					}
+					p = group_end;
+				}
+				else if (c == quote)
+				{
+					quote = 0;
+				}
+			}
+			else if (c == '\'' || c == '\"')
+			{
+				quote = c;
+			}
+			else if ((c == '$' && (p[1] == '{' || p[1] == '(')) || c == '`') // ${...}, $(...) and `...` stay in one word
+			{
+				char *group_end = (char *) lex_group_end(p);
+				if (group_end == NULL)
+				{
+					fprintf(stderr, "Syntax error: unterminated %.2s\n", p);
+					return -1;
+				}
+				p = group_end;
+			}
+			else if (c == '\\' && p[1] != '\0')
+			{
+				p++; // Escaped character belongs to the word
+			}
+			else if (c == ' ' || c == '\t' || c == '\r' || operator_type(c, '\0', '\0', &text) >= 0)
+			{
+				break;
+			}
+			c = *++p;
+		}
+		
+		if (quote != 0)
+		{
+			fprintf(stderr, "Syntax error: unterminated %c\n", quote);
+			return -1;
+		}
+		
+		// Terminate the word in place, "c" still holds the character that was overwritten
+		*p = '\0';
+		int io_number = is_io_number(word, c) ? atoi(word) : -1;
+		if (io_number < 0 && push_token(arena, tokens, &count, &capacity, TOKEN_WORD, word) < 0)
+		{
+			return -1;
+		}
+		if (c != '\0')
+		{
+			if ((type = operator_type(c, p[1], (p[1] != '\0') ? p[2] : '\0', &text)) >= 0)
+			{
+				if (push_token(arena, tokens, &count, &capacity, type, text) < 0)
+				{
+					return -1;
+				}
+				(*tokens)[count - 1].io_number = io_number;
+				p += strlen(text);
+			}
+			else
+			{
+				p++;
+			}
+			c = *p;
+		}
+	}
+	
+	return count;
+}
+
+// Returns the text of a token as it was typed (here-document bodies are shown by their delimiter)
+const char *lex_token_text(struct token *token)
+{
+	return (token->type == TOKEN_HEREDOC_BODY || token->type == TOKEN_HEREDOC_TEXT) ? token->delimiter : token->text;
+}
+
+// Joins the text of "count" tokens with spaces into the arena (e.g. command text for the job table)
+char *lex_join(struct arena *arena, struct token *tokens, int count)
+{
+	size_t length = 0;
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		length += strlen(lex_token_text(&tokens[i])) + 1 + ((tokens[i].io_number >= 0) ? 5 : 0);
+	}
+	
+	char *result = (char *) arena_alloc(arena, length + 1);
+	if (result == NULL)
+	{
+		return NULL;
+	}
+	
+	char *end = result;
+	for (i = 0; i < count; i++)
+	{
+		if (i > 0)
+		{
+			*end++ = ' ';
+		}
+		if (tokens[i].io_number >= 0) // Descriptor of a redirection (2>)
+		{
+			end += sprintf(end, "%d", tokens[i].io_number);
+		}
+		const char *text = lex_token_text(&tokens[i]);
+		size_t token_length = strlen(text);
+		memcpy(end, text, token_length);
+		end += token_length;
+	}
+	*end = '\0';
+	
+	return result;
+}
@@ -0,0 +1,51 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "arena.h"
+
+// Token types
+#define TOKEN_WORD 0
+#define TOKEN_SEMI 1 // ; or newline
+#define TOKEN_PIPE 2 // |
+#define TOKEN_AMP 3 // &
+#define TOKEN_LESS 4 // <
+#define TOKEN_GREAT 5 // >
+#define TOKEN_DLESS 6 // << here-document
+#define TOKEN_DLESSDASH 7 // <<- here-document, leading tabs removed
+#define TOKEN_TLESS 8 // <<< here-string
+#define TOKEN_HEREDOC_BODY 9 // Body of a here-document, expanded when the command runs
+#define TOKEN_HEREDOC_TEXT 10 // Body of a here-document with a quoted delimiter, used as it is
+#define TOKEN_DGREAT 11 // >>
+#define TOKEN_GREATAND 12 // >& (duplicate an output descriptor)
+#define TOKEN_LESSAND 13 // <& (duplicate an input descriptor)
+#define TOKEN_ANDGREAT 14 // &> (stdout and stderr)
+#define TOKEN_ANDDGREAT 15 // &>> (stdout and stderr, appending)
+
+#define LEX_INITIAL_TOKENS 32
+
+// A token of an input line
+struct token
+{
+	int type;
+	char *text; // Word text (quotes kept), operator spelling or here-document body
+	char *delimiter; // Delimiter word of a here-document body
+	int io_number; // Descriptor written before a redirection operator (2>), -1 if none
+};
+
+// Returns the character closing the ${...}, $(...) or `...` group that starts at p, NULL if it is not closed
+const char *lex_group_end(const char *p);
+
+// Splits "line" into tokens in a single pass, words are terminated in place inside "line"
+// The token array is allocated from the arena, returns the number of tokens or -1 on a syntax error
+int lex_line(struct arena *arena, char *line, struct token **tokens);
+
+// Returns the text of a token as it was typed (here-document bodies are shown by their delimiter)
+const char *lex_token_text(struct token *token);
+
+// Joins the text of "count" tokens with spaces into the arena (e.g. command text for the job table)
+char *lex_join(struct arena *arena, struct token *tokens, int count);
+
+#endif
@@ -0,0 +1,160 @@
+#include "line_reader.h"
+
+// Picks how much input may be read ahead on the reader's descriptor
+static void detect_mode(struct line_reader *reader)
+{
+	if (lseek(reader->fd, 0, SEEK_CUR) >= 0)
+	{
+		reader->mode = LINE_READER_SEEKABLE;
+	}
+	else if (isatty(reader->fd))
+	{
+		reader->mode = LINE_READER_TERMINAL;
+	}
+	else
+	{
+		reader->mode = LINE_READER_BYTES;
+	}
+}
+
+// Refills the read-ahead buffer, returns the number of bytes read (0 = end of input, -1 = error)
+static ssize_t fill_buffer(struct line_reader *reader)
+{
+	if (reader->mode == LINE_READER_UNKNOWN)
+	{
+		detect_mode(reader);
+	}
+	
+	if (reader->buf == NULL && (reader->buf = (char *) malloc(LINE_READER_BUF_SIZE)) == NULL)
+	{
+		perror("malloc");
+		return -1;
+	}
+	
+	size_t size = (reader->mode == LINE_READER_BYTES) ? 1 : LINE_READER_BUF_SIZE;
+	ssize_t n;
+	while ((n = read(reader->fd, reader->buf, size)) < 0 && errno == EINTR)
+	{
+		// Interrupted by SIGCHLD -> try again
+	}
+	
+	reader->start = 0;
+	reader->end = (n > 0) ? n : 0;
+	return n;
+}
+
+// Appends len bytes to the line, growing it when needed
+static int append_line(char **line, size_t *line_size, size_t length, const char *data, size_t len)
+{
+	if (length + len + 1 > *line_size)
+	{
+		size_t new_size = (*line_size == 0) ? LINE_READER_INITIAL_LINE : *line_size;
+		while (length + len + 1 > new_size)
+		{
+			new_size *= 2;
+		}
+		
+		char *new_line = (char *) realloc(*line, new_size);
+		if (new_line == NULL)
+		{
+			perror("realloc");
+			return -1;
+		}
+		*line = new_line;
+		*line_size = new_size;
+	}
+	
+	memcpy(*line + length, data, len);
+	return 0;
+}
+
+// Reads the next line into *line, joining lines ending in a backslash
+ssize_t read_line(struct line_reader *reader, char **line, size_t *line_size, const char *continuation_prompt)
+{
+	size_t length = 0;
+	int got_input = 0;
+	
+	if (append_line(line, line_size, 0, "", 0) < 0) // Make sure there is room for the terminator
+	{
+		return -1;
+	}
+	
+	while (1)
+	{
+		if (reader->start == reader->end)
+		{
+			ssize_t n = fill_buffer(reader);
+			if (n < 0)
+			{
+				perror("read");
+				return -1;
+			}
+			if (n == 0) // End of input -> last line may have no newline
+			{
+				if (!got_input)
+				{
+					return -1;
+				}
+				break;
+			}
+		}
+		got_input = 1;
+		
+		char *data = reader->buf + reader->start;
+		size_t available = reader->end - reader->start;
+		char *newline = memchr(data, '\n', available);
+		size_t len = (newline != NULL) ? (size_t) (newline - data) : available;
+		
+		if (append_line(line, line_size, length, data, len) < 0)
+		{
+			return -1;
+		}
+		length += len;
+		reader->start += len;
+		
+		if (newline == NULL)
+		{
+			continue;
+		}
+		reader->start++; // Newline itself
+		
+		// An odd number of trailing backslashes escapes the newline -> line continues
+		size_t backslashes = 0;
+		while (backslashes < length && (*line)[length - 1 - backslashes] == '\\')
+		{
+			backslashes++;
+		}
+		if (backslashes % 2 == 0)
+		{
+			break;
+		}
+		
+		length--;
+		if (continuation_prompt != NULL)
+		{
+			printf("%s", continuation_prompt);
+			fflush(stdout);
+		}
+	}
+	
+	(*line)[length] = '\0';
+	return length;
+}
+
+// Gives back read-ahead input, so the next process reading fd starts right after the last line
+void line_reader_sync(struct line_reader *reader)
+{
+	if (reader->mode == LINE_READER_SEEKABLE && reader->start < reader->end)
+	{
+		lseek(reader->fd, -(off_t) (reader->end - reader->start), SEEK_CUR);
+		reader->start = reader->end = 0;
+	}
+}
+
+// Frees the read-ahead buffer of the reader
+void line_reader_free(struct line_reader *reader)
+{
+	free(reader->buf);
+	reader->buf = NULL;
+	reader->start = reader->end = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define LINE_READER_BUF_SIZE 65536
+#define LINE_READER_INITIAL_LINE 1024
+
+#define LINE_READER_UNKNOWN 0 // Mode not decided yet (first read)
+#define LINE_READER_SEEKABLE 1 // Regular file: read ahead, seek back what was not used
+#define LINE_READER_TERMINAL 2 // Terminal: the driver hands out one line per read
+#define LINE_READER_BYTES 3 // Pipe or socket: read a byte at a time so nothing after the line is consumed
+
+// Reads lines of any length from a file descriptor
+struct line_reader
+{
+	int fd;
+	int mode; // LINE_READER_*
+	char *buf; // Read-ahead buffer
+	size_t start; // First unused byte in buf
+	size_t end; // End of the valid bytes in buf
+};
+
+// Reads the next line (without the newline) into *line like getline, joining lines ending in a backslash
+// *line is grown as needed and *line_size updated, continuation_prompt is printed before each continued line (NULL = nothing)
+// Returns the line length, -1 at end of input or on error
+ssize_t read_line(struct line_reader *reader, char **line, size_t *line_size, const char *continuation_prompt);
+
+// Gives back read-ahead input (seekable input only), so the next process reading fd starts right after the last line
+void line_reader_sync(struct line_reader *reader);
+
+// Frees the read-ahead buffer of the reader
+void line_reader_free(struct line_reader *reader);
+
+#endif
@@ -0,0 +1,113 @@
+#include "output.h"
+
+static char buffer[OUTPUT_BUF_SIZE];
+static size_t buffered = 0; // Bytes waiting in buffer
+static int buffer_fd = -1; // Descriptor the buffered bytes are for
+
+// Writes every byte of the vectors, resuming after partial writes
+static int write_vector(int fd, struct iovec *iov, int count)
+{
+	while (count > 0)
+	{
+		ssize_t n = writev(fd, iov, count);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		
+		// Skip what was written
+		while (count > 0 && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0)
+		{
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	
+	return 0;
+}
+
+// Writes out everything buffered
+int out_flush(void)
+{
+	if (buffered == 0)
+	{
+		return 0;
+	}
+	
+	struct iovec iov = {buffer, buffered};
+	buffered = 0; // Dropped on error, the next built-in starts clean
+	return write_vector(buffer_fd, &iov, 1);
+}
+
+// Appends length bytes of data for fd
+int out_write(int fd, const char *data, size_t length)
+{
+	if (fd != buffer_fd)
+	{
+		out_flush();
+		buffer_fd = fd;
+	}
+	
+	if (buffered + length <= OUTPUT_BUF_SIZE)
+	{
+		memcpy(buffer + buffered, data, length);
+		buffered += length;
+		return 0;
+	}
+	
+	// Does not fit -> the buffer and the data leave with a single writev
+	struct iovec iov[2] = {{buffer, buffered}, {(void *) data, length}};
+	int count = (buffered > 0) ? 2 : 1;
+	buffered = 0;
+	return write_vector(fd, iov + 2 - count, count);
+}
+
+// Appends formatted text for fd
+int out_printf(int fd, const char *format, ...)
+{
+	if (fd != buffer_fd)
+	{
+		out_flush();
+		buffer_fd = fd;
+	}
+	
+	// Formatted straight into the free part of the buffer when it fits
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(buffer + buffered, OUTPUT_BUF_SIZE - buffered, format, args);
+	va_end(args);
+	if (length < 0)
+	{
+		return -1;
+	}
+	if (buffered + length < OUTPUT_BUF_SIZE)
+	{
+		buffered += length;
+		return length;
+	}
+	
+	// Too long for what is left -> format it on its own
+	char *text = (char *) malloc(length + 1);
+	if (text == NULL)
+	{
+		perror("malloc");
+		return -1;
+	}
+	va_start(args, format);
+	vsnprintf(text, length + 1, format, args);
+	va_end(args);
+	
+	int result = out_write(fd, text, length);
+	free(text);
+	return (result < 0) ? -1 : length;
+}
@@ -0,0 +1,26 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define OUTPUT_BUF_SIZE 8192
+
+// Buffered output of the built-in commands: everything written to the same fd is collected and
+// handed to the kernel with one write when the buffer fills, the fd changes or the built-in returns
+
+// Appends length bytes of data for fd, larger writes go out together with the buffer in one writev
+int out_write(int fd, const char *data, size_t length);
+
+// Appends formatted text for fd, like dprintf
+int out_printf(int fd, const char *format, ...);
+
+// Writes out everything buffered, returns -1 if it could not be written (e.g. reader went away)
+int out_flush(void);
+
+#endif
@@ -0,0 +1,231 @@
+#include "path_cache.h"
+
+struct path_entry
+{
+	char *name; // Command name as typed
+	char *path; // Resolved executable path
+	int hits; // Number of lookups served from the cache
+	struct path_entry *next; // Next entry in the same bucket
+};
+
+static struct path_entry **buckets = NULL;
+static int num_buckets = 0;
+static int num_entries = 0;
+
+// Finds the entry for name, NULL if not cached
+static struct path_entry *find_entry(const char *name, unsigned int hash)
+{
+	if (buckets == NULL)
+	{
+		return NULL;
+	}
+	
+	struct path_entry *entry = buckets[hash & (num_buckets - 1)];
+	while (entry != NULL)
+	{
+		if (strcmp(entry->name, name) == 0)
+		{
+			return entry;
+		}
+		entry = entry->next;
+	}
+	
+	return NULL;
+}
+
+// Doubles the bucket array once the table gets crowded
+static int grow_buckets(void)
+{
+	int new_size = (num_buckets == 0) ? PATH_CACHE_INITIAL_BUCKETS : num_buckets * 2;
+	struct path_entry **new_buckets = (struct path_entry **) calloc(new_size, sizeof(struct path_entry *));
+	if (new_buckets == NULL)
+	{
+		perror("calloc");
+		return -1;
+	}
+	
+	int i;
+	for (i = 0; i < num_buckets; i++)
+	{
+		struct path_entry *entry = buckets[i];
+		while (entry != NULL)
+		{
+			struct path_entry *next = entry->next;
+			unsigned int slot = hash_string(entry->name) & (new_size - 1);
+			entry->next = new_buckets[slot];
+			new_buckets[slot] = entry;
+			entry = next;
+		}
+	}
+	
+	free(buckets);
+	buckets = new_buckets;
+	num_buckets = new_size;
+	return 0;
+}
+
+// Searches every $PATH directory for an executable regular file called name
+static char *search_path(const char *name)
+{
+	const char *path_var = var_get("PATH");
+	if (path_var == NULL)
+	{
+		return NULL;
+	}
+	
+	int name_len = strlen(name);
+	const char *dir = path_var;
+	while (1)
+	{
+		const char *end = strchr(dir, ':');
+		int dir_len = (end == NULL) ? strlen(dir) : end - dir;
+		
+		// Empty entry means current directory
+		char *candidate = (char *) malloc(dir_len + name_len + 3);
+		if (candidate == NULL)
+		{
+			perror("malloc");
+			return NULL;
+		}
+		if (dir_len == 0)
+		{
+			sprintf(candidate, "./%s", name);
+		}
+		else
+		{
+			sprintf(candidate, "%.*s/%s", dir_len, dir, name);
+		}
+		
+		struct stat st;
+		if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0)
+		{
+			return candidate;
+		}
+		free(candidate);
+		
+		if (end == NULL)
+		{
+			break;
+		}
+		dir = end + 1;
+	}
+	
+	return NULL;
+}
+
+// Resolves a command name to an executable path, using the cache when possible
+const char *path_lookup(const char *name)
+{
+	// Names with a slash are used as given, like execvp does
+	if (strchr(name, '/') != NULL)
+	{
+		return name;
+	}
+	
+	unsigned int hash = hash_string(name);
+	struct path_entry *entry = find_entry(name, hash);
+	if (entry != NULL)
+	{
+		entry->hits++;
+		return entry->path;
+	}
+	
+	char *path = search_path(name);
+	if (path == NULL)
+	{
+		errno = ENOENT;
+		return NULL;
+	}
+	
+	if (num_entries >= num_buckets && grow_buckets() < 0)
+	{
+		free(path);
+		return NULL;
+	}
+	
+	entry = (struct path_entry *) malloc(sizeof(struct path_entry));
+	if (entry == NULL)
+	{
+		perror("malloc");
+		free(path);
+		return NULL;
+	}
+	entry->name = (char *) malloc(strlen(name) + 1);
+	strcpy(entry->name, name);
+	entry->path = path;
+	entry->hits = 1;
+	
+	unsigned int slot = hash & (num_buckets - 1);
+	entry->next = buckets[slot];
+	buckets[slot] = entry;
+	num_entries++;
+	
+	return entry->path;
+}
+
+// Removes a single command from the cache (e.g. after it was not found at the cached path)
+void path_cache_forget(const char *name)
+{
+	if (buckets == NULL)
+	{
+		return;
+	}
+	
+	struct path_entry **link = &buckets[hash_string(name) & (num_buckets - 1)];
+	while (*link != NULL)
+	{
+		if (strcmp((*link)->name, name) == 0)
+		{
+			struct path_entry *entry = *link;
+			*link = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+			num_entries--;
+			return;
+		}
+		link = &(*link)->next;
+	}
+}
+
+// Removes every cached command (e.g. after $PATH changed)
+void path_cache_clear(void)
+{
+	int i;
+	for (i = 0; i < num_buckets; i++)
+	{
+		struct path_entry *entry = buckets[i];
+		while (entry != NULL)
+		{
+			struct path_entry *next = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+			entry = next;
+		}
+		buckets[i] = NULL;
+	}
+	
+	num_entries = 0;
+}
+
+// Prints cached commands with their hit counts
+void path_cache_print(int fd)
+{
+	if (num_entries == 0)
+	{
+		out_printf(fd, "hash: hash table empty\n");
+		return;
+	}
+	
+	out_printf(fd, "hits\tcommand\n");
+	int i;
+	for (i = 0; i < num_buckets; i++)
+	{
+		struct path_entry *entry;
+		for (entry = buckets[i]; entry != NULL; entry = entry->next)
+		{
+			out_printf(fd, "%4d\t%s\n", entry->hits, entry->path);
+		}
+	}
+}
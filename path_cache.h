@@ -0,0 +1,29 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "helper_functions.h"
+#include "variables.h"
+#include "output.h"
+
+#define PATH_CACHE_INITIAL_BUCKETS 64
+
+// Resolves a command name to an executable path, using the cache when possible
+// Returns NULL if not found in $PATH (errno = ENOENT)
+const char *path_lookup(const char *name);
+
+// Removes a single command from the cache (e.g. after it was not found at the cached path)
+void path_cache_forget(const char *name);
+
+// Removes every cached command (e.g. after $PATH changed)
+void path_cache_clear(void);
+
+// Prints cached commands with their hit counts
+void path_cache_print(int fd);
+
+#endif
@@ -0,0 +1,423 @@
+#define _GNU_SOURCE
+
+#include "redirect.h"
+
+// Adds a redirection to the end of the list
+static struct redirect *add_redirect(struct arena *arena, struct redirect ***last, int type, int fd, char *target, int source)
+{
+	struct redirect *redirect = (struct redirect *) arena_alloc(arena, sizeof(struct redirect));
+	if (redirect == NULL)
+	{
+		return NULL;
+	}
+	
+	redirect->type = type;
+	redirect->fd = fd;
+	redirect->target = target;
+	redirect->source = source;
+	redirect->saved = -1;
+	redirect->applied = 0;
+	redirect->next = NULL;
+	
+	**last = redirect;
+	*last = &redirect->next;
+	return redirect;
+}
+
+// Checks if text is a descriptor number
+static int is_number(const char *text)
+{
+	if (*text == '\0')
+	{
+		return 0;
+	}
+	while (*text >= '0' && *text <= '9')
+	{
+		text++;
+	}
+	
+	return *text == '\0';
+}
+
+// Splits "count" tokens of a command into expanded arguments and redirections
+int parse_command(struct arena *arena, struct token *tokens, int count, struct command *command)
+{
+	unsigned long long start = stats_now();
+	stats_counters[STAT_COMMANDS]++;
+	
+	// Words are collected first and expanded together
+	struct token *words = (struct token *) arena_alloc(arena, (count + 1) * sizeof(struct token));
+	if (words == NULL)
+	{
+		return -1;
+	}
+	int num_words = 0;
+	
+	struct redirect *redirects = NULL, **last = &redirects;
+	command->bg = 0;
+	
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		struct token *token = &tokens[i];
+		if (token->type == TOKEN_WORD)
+		{
+			words[num_words++] = *token;
+			continue;
+		}
+		
+		if (token->type == TOKEN_AMP)
+		{
+			if (i != count - 1)
+			{
+				// Error: & must be the last argument
+				fprintf(stderr, "Syntax error: & must end the command\n");
+				return -1;
+			}
+			command->bg = 1;
+			continue;
+		}
+		
+		// Every other operator is a redirection followed by its file name, descriptor or text
+		if (i + 1 == count || (tokens[i + 1].type != TOKEN_WORD && tokens[i + 1].type != TOKEN_HEREDOC_BODY && tokens[i + 1].type != TOKEN_HEREDOC_TEXT))
+		{
+			fprintf(stderr, "Syntax error: missing file name after %s\n", token->text);
+			return -1;
+		}
+		struct token *target_token = &tokens[++i];
+		int fd = token->io_number;
+		
+		char *target;
+		int drop;
+		if (target_token->type == TOKEN_HEREDOC_BODY)
+		{
+			target = expand_here_document(arena, target_token->text);
+		}
+		else if (target_token->type == TOKEN_HEREDOC_TEXT)
+		{
+			target = target_token->text;
+		}
+		else if (token->type == TOKEN_TLESS)
+		{
+			target = expand_here_string(arena, target_token->text);
+		}
+		else
+		{
+			target = expand_word(arena, target_token->text, &drop);
+		}
+		if (target == NULL)
+		{
+			return -1;
+		}
+		
+		struct redirect *redirect;
+		switch (token->type)
+		{
+			case TOKEN_LESS:
+				redirect = add_redirect(arena, &last, REDIRECT_INPUT, (fd >= 0) ? fd : 0, target, -1);
+				break;
+			case TOKEN_GREAT:
+				redirect = add_redirect(arena, &last, REDIRECT_OUTPUT, (fd >= 0) ? fd : 1, target, -1);
+				break;
+			case TOKEN_DGREAT:
+				redirect = add_redirect(arena, &last, REDIRECT_APPEND, (fd >= 0) ? fd : 1, target, -1);
+				break;
+			case TOKEN_DLESS: case TOKEN_DLESSDASH: case TOKEN_TLESS:
+				redirect = add_redirect(arena, &last, REDIRECT_TEXT, (fd >= 0) ? fd : 0, target, -1);
+				break;
+			case TOKEN_GREATAND: case TOKEN_LESSAND:
+				if (fd < 0)
+				{
+					fd = (token->type == TOKEN_GREATAND) ? 1 : 0;
+				}
+				if (strcmp(target, "-") == 0)
+				{
+					redirect = add_redirect(arena, &last, REDIRECT_CLOSE, fd, target, -1);
+				}
+				else if (is_number(target))
+				{
+					redirect = add_redirect(arena, &last, REDIRECT_DUP, fd, target, atoi(target));
+				}
+				else if (token->type == TOKEN_GREATAND && token->io_number < 0) // >&file is &>file
+				{
+					redirect = add_redirect(arena, &last, REDIRECT_OUTPUT, 1, target, -1);
+					redirect = (redirect == NULL) ? NULL : add_redirect(arena, &last, REDIRECT_DUP, 2, target, 1);
+				}
+				else
+				{
+					fprintf(stderr, "%s: bad file descriptor\n", target);
+					return -1;
+				}
+				break;
+			case TOKEN_ANDGREAT: case TOKEN_ANDDGREAT: // stdout to the file, stderr to the same place
+				redirect = add_redirect(arena, &last, (token->type == TOKEN_ANDGREAT) ? REDIRECT_OUTPUT : REDIRECT_APPEND, 1, target, -1);
+				redirect = (redirect == NULL) ? NULL : add_redirect(arena, &last, REDIRECT_DUP, 2, target, 1);
+				break;
+			default:
+				fprintf(stderr, "Syntax error: unexpected %s\n", token->text);
+				return -1;
+		}
+		if (redirect == NULL)
+		{
+			return -1;
+		}
+	}
+	
+	if ((command->argv = expand_argv(arena, words, num_words, &command->argc)) == NULL)
+	{
+		return -1;
+	}
+	command->redirects = redirects;
+	
+	stats_record_since(HIST_EXPAND, start);
+	return 0;
+}
+
+// Moves a descriptor opened for a redirection to lowest or above (a free descriptor may be the target of a later redirection)
+static int move_source(int fd, int lowest)
+{
+	if (fd < 0 || fd >= lowest)
+	{
+		return fd;
+	}
+	
+	int moved = fcntl(fd, F_DUPFD_CLOEXEC, lowest);
+	if (moved < 0)
+	{
+		perror("fcntl");
+	}
+	close(fd);
+	return moved;
+}
+
+// Opens the files and here-documents of the redirections
+int redirect_open(struct redirect *redirects)
+{
+	struct redirect *redirect;
+	int lowest = REDIRECT_LOWEST_SOURCE;
+	for (redirect = redirects; redirect != NULL; redirect = redirect->next)
+	{
+		if (redirect->fd >= lowest)
+		{
+			lowest = redirect->fd + 1;
+		}
+	}
+	
+	for (redirect = redirects; redirect != NULL; redirect = redirect->next)
+	{
+		unsigned long long start = trace_enabled ? stats_now() : 0;
+		switch (redirect->type)
+		{
+			case REDIRECT_INPUT:
+				redirect->source = open(redirect->target, O_RDONLY | O_CLOEXEC);
+				break;
+			case REDIRECT_OUTPUT:
+				redirect->source = open(redirect->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, REDIRECT_FILE_MODE);
+				break;
+			case REDIRECT_APPEND:
+				redirect->source = open(redirect->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, REDIRECT_FILE_MODE);
+				break;
+			case REDIRECT_TEXT:
+				if ((redirect->source = move_source(open_here_document(redirect->target), lowest)) < 0)
+				{
+					redirect_close(redirects);
+					return -1;
+				}
+				trace_event("redirect", "here-document", start, stats_now(), 0, -1);
+				continue;
+			default: // Nothing to open
+				continue;
+		}
+		
+		if (redirect->source < 0)
+		{
+			perror(redirect->target);
+			redirect_close(redirects);
+			return -1;
+		}
+		if ((redirect->source = move_source(redirect->source, lowest)) < 0)
+		{
+			redirect_close(redirects);
+			return -1;
+		}
+		trace_event("redirect", redirect->target, start, stats_now(), 0, -1);
+	}
+	
+	return 0;
+}
+
+// Closes the descriptors opened by redirect_open
+void redirect_close(struct redirect *redirects)
+{
+	struct redirect *redirect;
+	for (redirect = redirects; redirect != NULL; redirect = redirect->next)
+	{
+		if (redirect->type != REDIRECT_DUP && redirect->type != REDIRECT_CLOSE && redirect->source >= 0)
+		{
+			close(redirect->source);
+			redirect->source = -1;
+		}
+	}
+}
+
+// Checks if one of the redirections replaces descriptor fd
+int redirect_touches(struct redirect *redirects, int fd)
+{
+	for (; redirects != NULL; redirects = redirects->next)
+	{
+		if (redirects->fd == fd)
+		{
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+// Returns the descriptor a command reads its standard input from after the redirections
+int redirect_input(struct redirect *redirects)
+{
+	int input = -1;
+	for (; redirects != NULL; redirects = redirects->next)
+	{
+		if (redirects->fd == STDIN_FILENO)
+		{
+			input = (redirects->type == REDIRECT_CLOSE) ? -1 : redirects->source;
+		}
+	}
+	
+	return input;
+}
+
+// Adds the redirections to the file actions of a spawned command
+void redirect_spawn_actions(struct redirect *redirects, posix_spawn_file_actions_t *actions)
+{
+	for (; redirects != NULL; redirects = redirects->next)
+	{
+		if (redirects->type == REDIRECT_CLOSE)
+		{
+			posix_spawn_file_actions_addclose(actions, redirects->fd);
+		}
+		else
+		{
+			posix_spawn_file_actions_adddup2(actions, redirects->source, redirects->fd);
+		}
+	}
+}
+
+// Applies the redirections of every descriptor except stdin to the shell itself
+int redirect_save(struct redirect *redirects)
+{
+	// Output buffered before the redirection belongs to the old descriptors
+	fflush(stdout);
+	fflush(stderr);
+	
+	for (; redirects != NULL; redirects = redirects->next)
+	{
+		if (redirects->fd == STDIN_FILENO) // Built-ins get their input through command_input
+		{
+			continue;
+		}
+		
+		redirects->saved = fcntl(redirects->fd, F_DUPFD_CLOEXEC, 10); // -1 if fd was not open
+		if (redirects->type == REDIRECT_CLOSE)
+		{
+			close(redirects->fd);
+		}
+		else if (dup2(redirects->source, redirects->fd) < 0)
+		{
+			perror("dup2");
+			if (redirects->saved >= 0) // fd is unchanged, the later ones were never touched
+			{
+				close(redirects->saved);
+				redirects->saved = -1;
+			}
+			return -1;
+		}
+		redirects->applied = 1;
+	}
+	
+	return 0;
+}
+
+// Puts back one descriptor after the ones redirected later (a descriptor may be redirected twice)
+static void restore_from(struct redirect *redirect)
+{
+	if (redirect == NULL)
+	{
+		return;
+	}
+	restore_from(redirect->next);
+	
+	if (!redirect->applied) // stdin, or not reached because an earlier one failed
+	{
+		return;
+	}
+	redirect->applied = 0;
+	if (redirect->saved >= 0)
+	{
+		dup2(redirect->saved, redirect->fd);
+		close(redirect->saved);
+		redirect->saved = -1;
+	}
+	else
+	{
+		close(redirect->fd);
+	}
+}
+
+// Puts back the shell's descriptors replaced by redirect_save
+void redirect_restore(struct redirect *redirects)
+{
+	fflush(stdout);
+	fflush(stderr);
+	restore_from(redirects);
+}
+
+// Keeps the redirections applied by redirect_save for good
+void redirect_commit(struct redirect *redirects)
+{
+	for (; redirects != NULL; redirects = redirects->next)
+	{
+		if (redirects->saved >= 0)
+		{
+			close(redirects->saved);
+			redirects->saved = -1;
+		}
+		redirects->applied = 0;
+	}
+}
+
+// Returns a descriptor for reading text, staged in a memfd so nothing touches the file system
+int open_here_document(const char *text)
+{
+	int fd = memfd_create("ucysh-here-document", MFD_CLOEXEC);
+	if (fd < 0)
+	{
+		perror("memfd_create");
+		return -1;
+	}
+	
+	size_t length = strlen(text), written = 0;
+	while (written < length)
+	{
+		ssize_t n = write(fd, text + written, length - written);
+		if (n < 0)
+		{
+			perror("write");
+			close(fd);
+			return -1;
+		}
+		written += n;
+	}
+	
+	// Reader starts at the beginning of the text
+	if (lseek(fd, 0, SEEK_SET) < 0)
+	{
+		perror("lseek");
+		close(fd);
+		return -1;
+	}
+	
+	return fd;
+}
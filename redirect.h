@@ -0,0 +1,82 @@
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include "arena.h"
+#include "lexer.h"
+#include "expand.h"
+#include "trace.h"
+
+// Redirection types
+#define REDIRECT_INPUT 0 // n< file
+#define REDIRECT_OUTPUT 1 // n> file
+#define REDIRECT_APPEND 2 // n>> file
+#define REDIRECT_DUP 3 // n>&m or n<&m
+#define REDIRECT_CLOSE 4 // n>&- or n<&-
+#define REDIRECT_TEXT 5 // Here-document or here-string on n
+
+#define REDIRECT_FILE_MODE 0666 // Created files, before the umask
+#define REDIRECT_LOWEST_SOURCE 10 // Opened files are moved to at least this descriptor, above every redirected one
+
+// A redirection of one descriptor of a command, applied in order
+struct redirect
+{
+	int type; // REDIRECT_*
+	int fd; // Descriptor of the command that is redirected
+	char *target; // File name or here-document text
+	int source; // Descriptor copied onto fd: m of n>&m, or the one opened for target (-1 until redirect_open)
+	int saved; // Copy of the shell's own fd while a built-in runs with the redirection (-1 = fd was closed)
+	int applied; // Set by redirect_save once fd was replaced, only these are put back
+	struct redirect *next;
+};
+
+// A simple command: arguments, redirections and whether it runs in the background
+struct command
+{
+	char **argv;
+	int argc;
+	struct redirect *redirects; // In the order they were written
+	int bg;
+};
+
+// Splits "count" tokens of a command into expanded arguments and redirections (allocated from the arena)
+// Returns -1 on a syntax error (e.g. missing file name) or a failed expansion
+int parse_command(struct arena *arena, struct token *tokens, int count, struct command *command);
+
+// Opens the files and here-documents of the redirections (O_CLOEXEC), returns -1 if one could not be opened
+// The descriptors are moved above every descriptor the redirections replace, so applying one cannot overwrite another
+int redirect_open(struct redirect *redirects);
+
+// Closes the descriptors opened by redirect_open
+void redirect_close(struct redirect *redirects);
+
+// Checks if one of the redirections replaces descriptor fd
+int redirect_touches(struct redirect *redirects, int fd);
+
+// Returns the descriptor a command reads its standard input from after the redirections, -1 if not redirected
+int redirect_input(struct redirect *redirects);
+
+// Adds the redirections to the file actions of a spawned command (after its pipe ends were set up)
+void redirect_spawn_actions(struct redirect *redirects, posix_spawn_file_actions_t *actions);
+
+// Applies the redirections of every descriptor except stdin to the shell itself, for a built-in
+// The previous descriptors are kept until redirect_restore
+int redirect_save(struct redirect *redirects);
+
+// Puts back the shell's descriptors replaced by redirect_save
+void redirect_restore(struct redirect *redirects);
+
+// Keeps the redirections applied by redirect_save for good (exec without a command)
+void redirect_commit(struct redirect *redirects);
+
+// Returns a descriptor for reading text (here-document or here-string), staged in a memfd
+int open_here_document(const char *text);
+
+#endif
@@ -0,0 +1,149 @@
+#include "stats.h"
+
+unsigned long long stats_counters[NUM_STAT_COUNTERS] = {0};
+struct histogram stats_histograms[NUM_STAT_HISTOGRAMS] = {{0}};
+unsigned long long stats_line_start = 0;
+
+static const char *counter_names[NUM_STAT_COUNTERS] = {"lines", "commands", "spawns", "spawn_failures", "pipes", "built_ins", "substitutions", "arena_allocs", "arena_bytes", "arena_blocks"};
+static const char *histogram_names[NUM_STAT_HISTOGRAMS] = {"parse", "expand", "spawn", "first_exec", "wait", "line"};
+
+static char *dump_path = NULL; // $UCYSH_STATS when the shell started
+
+// Returns CLOCK_MONOTONIC in nanoseconds
+unsigned long long stats_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Adds a latency of "ns" nanoseconds to a histogram
+void stats_record(int histogram, unsigned long long ns)
+{
+	struct histogram *h = &stats_histograms[histogram];
+	
+	// Bucket = number of bits of ns
+	int bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+	h->buckets[(bucket < STATS_BUCKETS) ? bucket : STATS_BUCKETS - 1]++;
+	
+	if (h->count == 0 || ns < h->min)
+	{
+		h->min = ns;
+	}
+	if (ns > h->max)
+	{
+		h->max = ns;
+	}
+	h->count++;
+	h->sum += ns;
+}
+
+// Adds the time since "start" to a histogram
+void stats_record_since(int histogram, unsigned long long start)
+{
+	stats_record(histogram, stats_now() - start);
+}
+
+// Returns the upper bound of the bucket holding the given fraction of the values, capped at the maximum
+static unsigned long long percentile(struct histogram *h, double fraction)
+{
+	unsigned long rank = (unsigned long) (fraction * h->count), seen = 0;
+	int i;
+	for (i = 0; i < STATS_BUCKETS; i++)
+	{
+		seen += h->buckets[i];
+		if (seen > rank)
+		{
+			unsigned long long bound = (i == 0) ? 0 : (1ULL << i) - 1;
+			return (bound < h->max) ? bound : h->max;
+		}
+	}
+	
+	return h->max;
+}
+
+// Prints every counter and histogram
+void stats_print(int out, int json)
+{
+	int i, j;
+	if (!json)
+	{
+		for (i = 0; i < NUM_STAT_COUNTERS; i++)
+		{
+			out_printf(out, "%-16s%llu\n", counter_names[i], stats_counters[i]);
+		}
+		
+		out_printf(out, "\n%-16s%10s%12s%12s%12s%12s\n", "latency (us)", "count", "mean", "p50", "p99", "max");
+		for (i = 0; i < NUM_STAT_HISTOGRAMS; i++)
+		{
+			struct histogram *h = &stats_histograms[i];
+			out_printf(out, "%-16s%10lu%12.1f%12.1f%12.1f%12.1f\n", histogram_names[i], h->count,
+				(h->count > 0) ? h->sum / 1e3 / h->count : 0.0, percentile(h, 0.5) / 1e3, percentile(h, 0.99) / 1e3, h->max / 1e3);
+		}
+		return;
+	}
+	
+	out_printf(out, "{\"counters\": {");
+	for (i = 0; i < NUM_STAT_COUNTERS; i++)
+	{
+		out_printf(out, "%s\"%s\": %llu", (i > 0) ? ", " : "", counter_names[i], stats_counters[i]);
+	}
+	
+	out_printf(out, "}, \"histograms_ns\": {");
+	for (i = 0; i < NUM_STAT_HISTOGRAMS; i++)
+	{
+		struct histogram *h = &stats_histograms[i];
+		out_printf(out, "%s\"%s\": {\"count\": %lu, \"sum\": %llu, \"min\": %llu, \"max\": %llu, \"p50\": %llu, \"p99\": %llu, \"buckets\": [",
+			(i > 0) ? ", " : "", histogram_names[i], h->count, h->sum, h->min, h->max, percentile(h, 0.5), percentile(h, 0.99));
+		
+		// Buckets up to the last one used, bucket i holds values below 2^i
+		int last = STATS_BUCKETS - 1;
+		while (last > 0 && h->buckets[last] == 0)
+		{
+			last--;
+		}
+		for (j = 0; j <= last; j++)
+		{
+			out_printf(out, "%s%lu", (j > 0) ? ", " : "", h->buckets[j]);
+		}
+		out_printf(out, "]}");
+	}
+	out_printf(out, "}}\n");
+}
+
+// Sets every counter and histogram back to zero
+void stats_reset(void)
+{
+	memset(stats_counters, 0, sizeof(stats_counters));
+	memset(stats_histograms, 0, sizeof(stats_histograms));
+}
+
+// Writes the statistics as JSON to dump_path
+static void dump_stats(void)
+{
+	int fd = STDERR_FILENO;
+	if (strcmp(dump_path, "-") != 0 && (fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) < 0)
+	{
+		perror(dump_path);
+		return;
+	}
+	
+	stats_print(fd, 1);
+	out_flush();
+	if (fd != STDERR_FILENO)
+	{
+		close(fd);
+	}
+}
+
+// Writes the statistics as JSON to the file named by $UCYSH_STATS when the shell exits
+void stats_dump_at_exit(void)
+{
+	char *path = getenv("UCYSH_STATS");
+	if (path == NULL || *path == '\0' || (dump_path = strdup(path)) == NULL)
+	{
+		return;
+	}
+	
+	atexit(dump_stats);
+}
@@ -0,0 +1,70 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "output.h"
+
+// Counters (indexes of stats_counters)
+#define STAT_LINES 0 // Input lines executed
+#define STAT_COMMANDS 1 // Simple commands parsed
+#define STAT_SPAWNS 2 // Processes started with posix_spawn
+#define STAT_SPAWN_FAILURES 3 // posix_spawn calls that failed
+#define STAT_PIPES 4 // Pipes created for pipe sequences
+#define STAT_BUILT_INS 5 // Built-in commands run in the shell
+#define STAT_SUBSTITUTIONS 6 // Command substitutions
+#define STAT_ARENA_ALLOCS 7 // Allocations from arenas
+#define STAT_ARENA_BYTES 8 // Bytes allocated from arenas
+#define STAT_ARENA_BLOCKS 9 // Arena blocks taken from malloc
+#define NUM_STAT_COUNTERS 10
+
+// Latency histograms (indexes of stats_histograms), in nanoseconds
+#define HIST_PARSE 0 // Lexing a line and reading its here-documents
+#define HIST_EXPAND 1 // Expanding the words and redirections of a command
+#define HIST_SPAWN 2 // posix_spawn call
+#define HIST_FIRST_EXEC 3 // Start of a line until its first process was spawned
+#define HIST_WAIT 4 // Waiting for a foreground job
+#define HIST_LINE 5 // Executing a whole line
+#define NUM_STAT_HISTOGRAMS 6
+
+#define STATS_BUCKETS 48 // Bucket i counts values in [2^(i-1), 2^i) ns, the last one everything above
+
+// Latencies of one kind, in power of two buckets
+struct histogram
+{
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long buckets[STATS_BUCKETS];
+};
+
+// Returns CLOCK_MONOTONIC in nanoseconds
+unsigned long long stats_now(void);
+
+// Adds a latency of "ns" nanoseconds to a histogram
+void stats_record(int histogram, unsigned long long ns);
+
+// Adds the time since "start" (from stats_now) to a histogram
+void stats_record_since(int histogram, unsigned long long start);
+
+// Prints every counter and histogram (percentiles are bucket upper bounds), as JSON if json is set
+void stats_print(int out, int json);
+
+// Sets every counter and histogram back to zero
+void stats_reset(void);
+
+// Writes the statistics as JSON to the file named by $UCYSH_STATS ("-" = stderr) when the shell exits
+void stats_dump_at_exit(void);
+
+// Globals
+extern unsigned long long stats_counters[NUM_STAT_COUNTERS];
+extern struct histogram stats_histograms[NUM_STAT_HISTOGRAMS];
+extern unsigned long long stats_line_start; // stats_now when the current line started, 0 once it spawned a process
+
+#endif
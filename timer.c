@@ -0,0 +1,134 @@
+#include "timer.h"
+
+// Seconds from earlier to later
+static double seconds_between(struct timeval later, struct timeval earlier)
+{
+	return (later.tv_sec - earlier.tv_sec) + (later.tv_usec - earlier.tv_usec) / 1e6;
+}
+
+// Starts timing a command or pipe sequence
+void timer_start(struct command_timer *timer)
+{
+	// Peak RSS is a maximum, not a sum -> count from zero for this command
+	sigset_t orig_mask;
+	block_sigchld(&orig_mask);
+	timer->children_max_rss = children_max_rss;
+	children_max_rss = 0;
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+	
+	getrusage(RUSAGE_SELF, &timer->self);
+	getrusage(RUSAGE_CHILDREN, &timer->children);
+	clock_gettime(CLOCK_MONOTONIC, &timer->start);
+}
+
+// Prints seconds with the given decimals, as 1m2.345s in the long format
+static void print_seconds(double value, int precision, int long_format)
+{
+	if (long_format)
+	{
+		int minutes = (int) (value / 60);
+		out_printf(STDERR_FILENO, "%dm%.*fs", minutes, precision, value - minutes * 60);
+	}
+	else
+	{
+		out_printf(STDERR_FILENO, "%.*f", precision, value);
+	}
+}
+
+// Prints what was used since timer_start to stderr, formatted by $TIMEFORMAT
+void timer_report(struct command_timer *timer)
+{
+	struct timespec now;
+	struct rusage self, children;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+	
+	sigset_t orig_mask;
+	block_sigchld(&orig_mask);
+	long max_rss = children_max_rss;
+	if (timer->children_max_rss > children_max_rss)
+	{
+		children_max_rss = timer->children_max_rss;
+	}
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+	
+	// Every stage of a pipe sequence was reaped by wait4 before the report -> all of them are in RUSAGE_CHILDREN
+	double real = (now.tv_sec - timer->start.tv_sec) + (now.tv_nsec - timer->start.tv_nsec) / 1e9;
+	double user = seconds_between(self.ru_utime, timer->self.ru_utime) + seconds_between(children.ru_utime, timer->children.ru_utime);
+	double sys = seconds_between(self.ru_stime, timer->self.ru_stime) + seconds_between(children.ru_stime, timer->children.ru_stime);
+	long voluntary = (self.ru_nvcsw - timer->self.ru_nvcsw) + (children.ru_nvcsw - timer->children.ru_nvcsw);
+	long involuntary = (self.ru_nivcsw - timer->self.ru_nivcsw) + (children.ru_nivcsw - timer->children.ru_nivcsw);
+	
+	const char *format = var_get("TIMEFORMAT");
+	if (format == NULL)
+	{
+		format = TIMER_DEFAULT_FORMAT;
+	}
+	
+	const char *p;
+	for (p = format; *p != '\0'; p++)
+	{
+		if (*p == '\\' && (p[1] == 'n' || p[1] == 't'))
+		{
+			out_write(STDERR_FILENO, (*++p == 'n') ? "\n" : "\t", 1);
+			continue;
+		}
+		if (*p != '%' || p[1] == '\0')
+		{
+			out_write(STDERR_FILENO, p, 1);
+			continue;
+		}
+		
+		// %[precision][l]letter
+		int precision = 3, long_format = 0;
+		p++;
+		if (*p >= '0' && *p <= '9')
+		{
+			precision = (*p - '0' > 3) ? 3 : *p - '0';
+			p++;
+		}
+		if (*p == 'l')
+		{
+			long_format = 1;
+			p++;
+		}
+		
+		switch (*p)
+		{
+			case 'R':
+				print_seconds(real, precision, long_format);
+				break;
+			case 'U':
+				print_seconds(user, precision, long_format);
+				break;
+			case 'S':
+				print_seconds(sys, precision, long_format);
+				break;
+			case 'P':
+				out_printf(STDERR_FILENO, "%.*f", precision, (real > 0) ? 100 * (user + sys) / real : 0.0);
+				break;
+			case 'M':
+				out_printf(STDERR_FILENO, "%ld", max_rss);
+				break;
+			case 'w':
+				out_printf(STDERR_FILENO, "%ld", voluntary);
+				break;
+			case 'c':
+				out_printf(STDERR_FILENO, "%ld", involuntary);
+				break;
+			case '%':
+				out_write(STDERR_FILENO, "%", 1);
+				break;
+			case '\0': // Format ends in the middle of a specifier
+				p--;
+				break;
+			default:
+				out_printf(STDERR_FILENO, "%%%c", *p);
+				break;
+		}
+	}
+	
+	out_write(STDERR_FILENO, "\n", 1);
+	out_flush();
+}
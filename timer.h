@@ -0,0 +1,36 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "jobs.h"
+#include "output.h"
+#include "variables.h"
+
+// Report of the time keyword when $TIMEFORMAT is not set
+#define TIMER_DEFAULT_FORMAT "\nreal\t%3lR\nuser\t%3lU\nsys\t%3lS\nmaxrss\t%MKB\nctxsw\t%w voluntary, %c involuntary"
+
+// Resources used so far, taken when a timed command starts
+struct command_timer
+{
+	struct timespec start; // CLOCK_MONOTONIC
+	struct rusage self; // The shell itself (built-ins, expansion)
+	struct rusage children; // Reaped children
+	long children_max_rss; // children_max_rss before it was reset
+};
+
+// Starts timing a command or pipe sequence
+void timer_start(struct command_timer *timer);
+
+// Prints what was used since timer_start to stderr, formatted by $TIMEFORMAT:
+// %R real, %U user, %S system time in seconds (%[0-3]R for the decimals, %lR for 1m2.345s), %P CPU percentage,
+// %M largest max RSS of a child in KB, %w voluntary and %c involuntary context switches, %% a %, \n and \t escapes
+void timer_report(struct command_timer *timer);
+
+#endif
@@ -0,0 +1,133 @@
+#include "trace.h"
+
+int trace_enabled = 0;
+
+static struct trace_event *ring = NULL;
+static unsigned long num_events = 0; // Events ever recorded, the newest is at (num_events - 1) % TRACE_RING_SIZE
+static int shell_pid = 0;
+static char *dump_path = NULL; // $UCYSH_TRACE when the shell started
+
+// Records a span from start to end
+void trace_event(const char *category, const char *name, unsigned long long start, unsigned long long end, int tid, int status)
+{
+	if (!trace_enabled || start == 0) // start is 0 if tracing was turned on in the middle of the span
+	{
+		return;
+	}
+	if (ring == NULL)
+	{
+		if ((ring = (struct trace_event *) malloc(TRACE_RING_SIZE * sizeof(struct trace_event))) == NULL)
+		{
+			perror("malloc");
+			trace_enabled = 0;
+			return;
+		}
+		shell_pid = getpid();
+	}
+	
+	struct trace_event *event = &ring[num_events++ % TRACE_RING_SIZE];
+	event->start = start;
+	event->duration = (end > start) ? end - start : 0;
+	event->tid = (tid != 0) ? tid : shell_pid;
+	event->status = status;
+	event->category = category;
+	strncpy(event->name, name, TRACE_NAME_SIZE - 1);
+	event->name[TRACE_NAME_SIZE - 1] = '\0';
+}
+
+// Prints a JSON string, escaping quotes, backslashes and control characters
+static void print_json_string(int out, const char *text)
+{
+	out_write(out, "\"", 1);
+	for (; *text != '\0'; text++)
+	{
+		if (*text == '"' || *text == '\\')
+		{
+			out_printf(out, "\\%c", *text);
+		}
+		else if ((unsigned char) *text < 0x20)
+		{
+			out_printf(out, "\\u%04x", *text);
+		}
+		else
+		{
+			out_write(out, text, 1);
+		}
+	}
+	out_write(out, "\"", 1);
+}
+
+// Prints the recorded events as Chrome trace-event JSON
+void trace_print(int out)
+{
+	if (shell_pid == 0)
+	{
+		shell_pid = getpid();
+	}
+	
+	// Timestamps are microseconds with nanosecond decimals
+	out_printf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	out_printf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"ucysh\"}}", shell_pid, shell_pid);
+	
+	unsigned long i = (num_events > TRACE_RING_SIZE) ? num_events - TRACE_RING_SIZE : 0;
+	for (; i < num_events; i++)
+	{
+		struct trace_event *event = &ring[i % TRACE_RING_SIZE];
+		out_printf(out, ",\n{\"name\": ");
+		print_json_string(out, event->name);
+		out_printf(out, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %llu.%03llu, \"dur\": %llu.%03llu, \"pid\": %d, \"tid\": %d",
+			event->category, event->start / 1000, event->start % 1000, event->duration / 1000, event->duration % 1000, shell_pid, event->tid);
+		if (event->status >= 0)
+		{
+			out_printf(out, ", \"args\": {\"status\": %d}", event->status);
+		}
+		out_write(out, "}", 1);
+	}
+	
+	out_printf(out, "\n]}\n");
+}
+
+// Writes the JSON to a file
+int trace_write(const char *path)
+{
+	int fd = STDERR_FILENO;
+	if (strcmp(path, "-") != 0 && (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	
+	trace_print(fd);
+	out_flush();
+	if (fd != STDERR_FILENO)
+	{
+		close(fd);
+	}
+	
+	return 0;
+}
+
+// Forgets every recorded event
+void trace_clear(void)
+{
+	num_events = 0;
+}
+
+// Writes the trace to dump_path
+static void dump_trace(void)
+{
+	trace_write(dump_path);
+}
+
+// Starts tracing when $UCYSH_TRACE names a file, which receives the JSON when the shell exits
+void trace_dump_at_exit(void)
+{
+	char *path = getenv("UCYSH_TRACE");
+	if (path == NULL || *path == '\0' || (dump_path = strdup(path)) == NULL)
+	{
+		return;
+	}
+	
+	trace_enabled = 1;
+	atexit(dump_trace);
+}
@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "output.h"
+#include "stats.h"
+
+#define TRACE_RING_SIZE 16384 // Newest events kept, older ones are overwritten
+#define TRACE_NAME_SIZE 64 // Longer names are cut
+
+// One traced span of the shell or of a child process
+struct trace_event
+{
+	unsigned long long start; // stats_now() when it began
+	unsigned long long duration; // Nanoseconds
+	int tid; // Shell pid for work done in the shell, child pid for a process
+	int status; // Exit status of a process or command, -1 if none
+	const char *category; // "command", "stage", "spawn", "process", "redirect", "builtin", "parse"
+	char name[TRACE_NAME_SIZE];
+};
+
+// Records a span from start to end (stats_now() values), tid 0 = the shell itself, nothing if start is 0
+void trace_event(const char *category, const char *name, unsigned long long start, unsigned long long end, int tid, int status);
+
+// Prints the recorded events as Chrome trace-event JSON (loads in chrome://tracing and Perfetto)
+void trace_print(int out);
+
+// Writes the JSON to a file, returns -1 if it could not be opened
+int trace_write(const char *path);
+
+// Forgets every recorded event
+void trace_clear(void);
+
+// Starts tracing when $UCYSH_TRACE names a file, which receives the JSON when the shell exits ("-" = stderr)
+void trace_dump_at_exit(void);
+
+// Globals
+extern int trace_enabled; // Events are only recorded while set (trace on/off)
+
+#endif
@@ -1,544 +1,1076 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <time.h>
 #include "helper_functions.h"
 #include "built_in_functions.h"
+#include "jobs.h"
+#include "lexer.h"
+#include "expand.h"
+#include "redirect.h"
+#include "timer.h"
+#include "trace.h"
 
-#define MAX_COMMANDS 512
-#define MAX_PIPED_COMMANDS 512
-#define MAX_PIPES 9
-
-#define EXIT_CHILD -2
 
 #define READ 0
 #define WRITE 1
 
+struct arena line_arena = {0}; // Everything parsed from the current input line
+
+const char *script_text = NULL; // Script being executed, NULL when commands come from stdin
+size_t script_length = 0;
+size_t script_position = 0; // Start of the next unread script line
+
 
 // Process handling funuctions
 
 // Signal handler
 void signal_handler(int sig);
 
-// Add a process id to the running processes
-int add_running_process(int pid, int *pids);
+// Spawn an external command (resolved through the path cache) with posix_spawn into process group pgid (0 = new group),
+// redirecting stdin/stdout to fd_r/fd_w (-1 = inherit) and then applying redirects (opened), envp is its environment
+// A new group of a foreground job takes the terminal before the command starts
+int spawn_command(char **argv, char **envp, int fd_r, int fd_w, struct redirect *redirects, sigset_t *child_mask, int pgid, int foreground);
+
+// Returns the number of leading "name=value" words of argv (prefix assignments)
+int count_assignments(char **argv);
+
+// Assigns the first count words of argv as shell variables, returns -1 if one failed
+int assign_variables(char **argv, int count);
+
+// Counts the commands of a pipe sequence ("count" tokens) that start a process, i.e. not built-ins or assignments only
+int count_spawned_commands(struct token *tokens, int count);
+
+// Run a built-in command in the shell with its output captured in memfd, then feed the output into the pipe write end fd_w
+int execute_built_in_piped(char **argv, int built_in_index, int memfd, int fd_w);
+
+// Writes a captured built-in output ({memfd, fd_w, size}) into a pipe and closes both ends
+void *pump_built_in_output(void *arg);
+
+// Execute every command of an input line (modifies input_buf)
+void execute_line(char *input_buf);
+
+// Execute a script line by line, without prompt or history
+int execute_script(const char *text, size_t length);
+
+// Copies the next line of the script into *line (growing it), joining lines ending in a backslash when join is set
+// Returns the line length, -1 at the end of the script
+ssize_t next_script_line(char **line, size_t *line_size, int join);
+
+// Reads every here-document body of the line (after the line itself) into the token of its delimiter
+int read_here_documents(struct token *tokens, int count);
 
-// Remove a process id from the running processes
-int remove_running_process(int pid, int *pids);
+// Execute a script file, returns the exit status of its last command
+int execute_script_file(const char *path);
 
-// Execute a command that is in a pipe sequence
-int execute_piped(char **argv, int index_r, int index_w, int (*pipes)[2], int num_pipes, int bg);
+// Execute a command that is in a pipe sequence as part of job, reading from fd_r and writing to fd_w (-1 = inherit)
+// Its own redirections (opened) are applied after the pipe ends
+// Returns the pid of the started process, 0 if it ran in the shell, -1 on failure
+int execute_piped(char **argv, struct redirect *redirects, struct job *job, int fd_r, int fd_w);
 
-// Execute a command
-int execute(char **argv, int fd_r, int fd_w, int bg);
+// Execute a command with its redirections (opened), command_line is its text for the job table
+int execute(char **argv, struct redirect *redirects, int bg, const char *command_line);
 
 
 int main(int argc, char **argv, char **environ)
 {
-	// Get a reference to inherited environment variables names
-	while (total_env < MAX_ENVIRONMENT_VARIABLES && environ[total_env] != NULL)
-	{
-		int index_eq = index_of_str(environ[total_env], '=');
-		char *name = substr(environ[total_env], 0, index_eq);
-		environment_variables[total_env] = (char *) malloc(strlen(name) + 1);
-		strcpy(environment_variables[total_env], name);
-		total_env++;
-	}
+	// Inherited environment variables become exported shell variables
+	var_import_environment(environ);
 	
 	// Init rng
 	srand(time(NULL));
 	
-	int i_hist = 0;
-	
-	int num_commands = 0;
-	int num_piped_commands = 0;
-	int num_args = 0;
-	
-	int pipes[MAX_PIPES][2];
-	
-	char input_buf[INPUT_BUF_SIZE];
-	char *args[MAX_ARGS];
-	char *piped_commands[MAX_PIPED_COMMANDS];
-	char *commands[MAX_COMMANDS];
+	// $UCYSH_STATS -> counters and latencies are written out on exit, $UCYSH_TRACE -> trace of every command
+	stats_dump_at_exit();
+	trace_dump_at_exit();
 	
 	// Set signal handler
 	signal(SIGCHLD, signal_handler);
 	signal(SIGINT, signal_handler);
-	signal(SIGUSR1, signal_handler);
+	
+	// Non-interactive modes: ucysh -c 'commands' [name [args]] / ucysh script [args]
+	if (argc > 1)
+	{
+		jobs_init(0);
+		
+		if (strcmp(argv[1], "-c") == 0)
+		{
+			if (argc < 3)
+			{
+				fprintf(stderr, "%s: -c: option requires an argument\n", argv[0]);
+				exit(2);
+			}
+			
+			// $0 is the optional name after the commands, like sh -c
+			positional_params = (argc > 3) ? argv + 3 : argv;
+			num_positional_params = (argc > 3) ? argc - 3 : 1;
+			
+			execute_script(argv[2], strlen(argv[2]));
+			exit(last_exit_status);
+		}
+		
+		positional_params = argv + 1;
+		num_positional_params = argc - 1;
+		
+		exit(execute_script_file(argv[1]));
+	}
+	
+	positional_params = argv;
+	num_positional_params = 1;
+	jobs_init(1);
+	
+	// History file only for terminals or when asked for with $HISTFILE
+	if (shell_is_interactive || var_get("HISTFILE") != NULL)
+	{
+		history_init();
+	}
+	
+	char *input_buf = NULL;
+	size_t input_size = 0;
 	
 	while (1)
 	{
+		// Report and forget finished background jobs
+		sigset_t orig_mask;
+		block_sigchld(&orig_mask);
+		jobs_notify();
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+		
 		printf("%d-ucysh> ", num_forked_processes);
+		fflush(stdout);
 		
-		// Get user input
-		if (fgets(input_buf, sizeof(input_buf), stdin) == NULL)
+		// Get user input, any length
+		if (read_line(&stdin_reader, &input_buf, &input_size, "> ") < 0)
 		{
-			perror("fgets"); exit(1);
+			char *exit_args[2] = {NULL, NULL};
+			exit_shell(exit_args, STDOUT_FILENO); // End of input
+		}
+		
+		// Recall earlier lines (!!, !prefix), the expanded line is shown like in sh
+		int recalled = history_expand(&input_buf, &input_size);
+		if (recalled < 0)
+		{
+			last_exit_status = 1;
+			continue;
+		}
+		else if (recalled > 0)
+		{
+			printf("%s\n", input_buf);
 		}
 		
 		// Add command to history
-		history_commands[i_hist] = (char *) malloc(strlen(input_buf) + 1);
-		strcpy(history_commands[i_hist++], input_buf); 
+		history_add(input_buf);
 		
-		// Tokenize commands based on ';'
-		if ((num_commands = tokenize(input_buf, ";\n", commands)) < 0)
+		execute_line(input_buf);
+	}
+	return 0;
+}
+
+// Returns the number of leading "name=value" words of argv
+int count_assignments(char **argv)
+{
+	int count = 0;
+	while (argv[count] != NULL && is_variable_assignment(argv[count]))
+	{
+		count++;
+	}
+	
+	return count;
+}
+
+// Assigns the first count words of argv as shell variables
+int assign_variables(char **argv, int count)
+{
+	int result = 0;
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		if (variable_assignment(argv[i]) < 0)
+		{
+			result = -1;
+		}
+	}
+	
+	return result;
+}
+
+// Counts the commands of a pipe sequence that start a process, from their first word before expansion
+int count_spawned_commands(struct token *tokens, int count)
+{
+	int spawned = 0, in_command = 0; // in_command: the first word of the current command was seen
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		if (tokens[i].type == TOKEN_PIPE)
+		{
+			in_command = 0;
+		}
+		else if (tokens[i].type == TOKEN_WORD)
+		{
+			if (!in_command && !is_variable_assignment(tokens[i].text))
+			{
+				in_command = 1;
+				if (is_built_in(tokens[i].text) < 0)
+				{
+					spawned++;
+				}
+			}
+		}
+		else if (tokens[i].type != TOKEN_AMP) // Redirection -> skip its file name
 		{
-			fprintf(stderr, "Unable to tokenize commands\n");
-			exit(1);
+			i++;
+		}
+	}
+	
+	return spawned;
+}
+
+
+void execute_line(char *input_buf)
+{
+	// Everything parsed from the previous line is released at once
+	arena_reset(&line_arena);
+	
+	stats_counters[STAT_LINES]++;
+	unsigned long long start = stats_line_start = stats_now();
+	execute_commands(input_buf);
+	stats_record_since(HIST_LINE, start);
+}
+
+// Executes every command of a line without releasing the line arena
+void execute_commands(char *input_buf)
+{
+	struct token *tokens;
+	int num_tokens;
+	unsigned long long parse_start = stats_now();
+	if ((num_tokens = lex_line(&line_arena, input_buf, &tokens)) < 0 || read_here_documents(tokens, num_tokens) < 0)
+	{
+		last_exit_status = 2;
+		return;
+	}
+	stats_record_since(HIST_PARSE, parse_start);
+	trace_event("parse", "parse", parse_start, stats_now(), 0, -1);
+	
+	// For each command (separated by ';')
+	int i_comm = 0;
+	while (i_comm < num_tokens)
+	{
+		int end = i_comm, num_piped_commands = 1;
+		while (end < num_tokens && tokens[end].type != TOKEN_SEMI)
+		{
+			if (tokens[end].type == TOKEN_PIPE)
+			{
+				num_piped_commands++;
+			}
+			end++;
 		}
 		
-		int i_comm = 0;
-		//printf("Total %d commands\n", num_commands);
+		if (end == i_comm) // Empty command
+		{
+			i_comm = end + 1;
+			continue;
+		}
 		
-		// For each command
-		while (commands[i_comm] != NULL)
+		// time keyword -> report what the whole command or pipe sequence used
+		struct command_timer timer;
+		int timed = (tokens[i_comm].type == TOKEN_WORD && strcmp(tokens[i_comm].text, "time") == 0);
+		if (timed)
 		{
-			//printf("Command: %s\n", commands[i_comm]);
-			
-			// Tokenize commands based on '|'
-			if ((num_piped_commands = tokenize(commands[i_comm], "|", piped_commands)) < 0)
+			timer_start(&timer);
+			if (++i_comm == end) // Nothing to time
 			{
-				fprintf(stderr, "Unable to tokenize piped commands\n");
-				exit(1);
+				timer_report(&timer);
+				i_comm = end + 1;
+				continue;
 			}
-			
-			int i_piped = 0;
-			//printf("Total %d piped commands\n", num_piped_commands);
-			
-			// If no pipe -> 1 command
-			if (num_piped_commands == 1)
+		}
+		
+		// Command text for the job table
+		char *command_line = lex_join(&line_arena, tokens + i_comm, end - i_comm);
+		unsigned long long command_start = trace_enabled ? stats_now() : 0;
+		
+		// If no pipe -> 1 command
+		if (num_piped_commands == 1)
+		{
+			struct command command;
+			if (parse_command(&line_arena, tokens + i_comm, end - i_comm, &command) < 0)
 			{
-				//printf("\tOnly one sub-command: %s\n", piped_commands[i_piped]);
-				
-				// Tokenize commands based on whitespaces
-				if ((num_args = tokenize(piped_commands[i_piped], " \t\n", args)) < 0)
+				last_exit_status = 2;
+			}
+			else if (command.argc == 0 && command.redirects == NULL)
+			{
+				fprintf(stderr, "Invalid arguments\n");
+				last_exit_status = 2;
+			}
+			else if (redirect_open(command.redirects) < 0) // Not executed when a redirection could not be opened
+			{
+				last_exit_status = 1;
+			}
+			else
+			{
+				if (execute(command.argv, command.redirects, command.bg, command_line) < 0)
 				{
-					fprintf(stderr, "Unable to tokenize arguments\n");
-					exit(1);
+					fprintf(stderr, "Unable to execute command\n");
 				}
 				
-				char *input_file = NULL, *output_file = NULL;
-				int bg = 0;
-				if ((num_args = parse_args(args, num_args, &input_file, &output_file, &bg)) < 0)
+				// Child has its own copies now
+				redirect_close(command.redirects);
+			}
+		}
+		else // Pipe sequence, every command may have its own redirections
+		{
+			// Check if it is able to spawn processes
+			if (!jobs_can_start(count_spawned_commands(tokens + i_comm, end - i_comm)))
+			{
+				fprintf(stderr, "Insufficient Resources\n");
+			}
+			else
+			{
+				int pid = 0, stage_status = 0; // Of the last command started
+				int pipe_fds[2];
+				int fd_r = -1, fd_w = -1; // Default (STDIN/STDOUT)
+				
+				sigset_t orig_mask;
+				struct job *job = job_create(command_line);
+				int bg = (tokens[end - 1].type == TOKEN_AMP); // & after the last command -> the whole sequence runs in the background
+				
+				pipe_failure = (job == NULL);
+				if (job != NULL)
 				{
-					fprintf(stderr, "Invalid arguments\n");
-					//exit(1);
+					job->bg = bg;
 				}
-				else
+				
+				int i_piped, start = i_comm;
+				for (i_piped = 0; i_piped < num_piped_commands && !pipe_failure; i_piped++)
 				{
-					int fd_r = -1, fd_w = -1;
-					int exit_code, input_ok = 1;
-					// printf("Num args after parsing: %d\n", num_args);
-					// if (input_file != NULL) printf("Input file: %s\n", input_file);
-					// if (output_file != NULL) printf("Output file: %s\n", output_file);
-					// printf("%s\n", (bg) ? "Background" : "Foreground");
+					// Arguments of this command run up to the next '|'
+					int stage_end = start;
+					while (stage_end < end && tokens[stage_end].type != TOKEN_PIPE)
+					{
+						stage_end++;
+					}
+					struct command command;
+					int parsed = parse_command(&line_arena, tokens + start, stage_end - start, &command);
+					start = stage_end + 1;
 					
-					// Redirect input
-					if (input_file != NULL)
+					// Only the whole sequence can run in the background
+					if (parsed < 0 || command.argc == 0 || (command.bg && i_piped < num_piped_commands - 1))
 					{
-						if ((fd_r = open(input_file, O_RDONLY)) < 0)
+						if (parsed == 0)
 						{
-							perror("open");
-							input_ok = 0;
+							fprintf(stderr, "Invalid arguments\n");
 						}
+						job_kill(job, SIGKILL);
+						pipe_failure = 1;
+						pid = -1;
+						break;
 					}
 					
-					// Redirect output
-					if (output_file != NULL)
+					// Open the pipe to the next command only now, so the shell holds O(1) descriptors
+					if (i_piped < num_piped_commands - 1)
 					{
-						if ((fd_w = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+						if (pipe2(pipe_fds, O_CLOEXEC) < 0)
 						{
-							perror("open");
-							input_ok = 0;
+							perror("pipe");
+							job_kill(job, SIGKILL);
+							pipe_failure = 1;
+							fd_w = -1;
 						}
+						else
+						{
+							fd_w = pipe_fds[WRITE];
+							stats_counters[STAT_PIPES]++;
+						}
+					}
+					else // Last command
+					{
+						fd_w = -1;
 					}
 					
-					// Execute command
-					if ((exit_code = execute(args, fd_r, fd_w, bg)) < 0)
+					// Execute command, one that cannot run (redirection not opened, not found) only drops out of the sequence
+					if (pipe_failure)
+					{
+						pid = -1; // Pipe could not be opened
+					}
+					else if (redirect_open(command.redirects) < 0)
 					{
-						fprintf(stderr, "Unable to execute command\n");
-						if (exit_code == EXIT_CHILD)
+						pid = -1;
+						stage_status = 1;
+					}
+					else
+					{
+						unsigned long long stage_start = trace_enabled ? stats_now() : 0;
+						if ((pid = execute_piped(command.argv, command.redirects, job, fd_r, fd_w)) < 0)
 						{
-							exit(1); // Child
+							fprintf(stderr, "Unable to execute command\n");
 						}
+						stage_status = last_exit_status;
+						redirect_close(command.redirects);
+						trace_event("stage", command.argv[0], stage_start, stats_now(), 0, -1);
+					}
+					
+					// The command has its own copies -> close the shell's ends right away
+					if (fd_r != -1)
+					{
+						close(fd_r);
 					}
-					else if (input_ok)
+					if (fd_w != -1)
 					{
-						num_forked_processes++;
+						close(fd_w);
 					}
+					fd_r = (fd_w != -1) ? pipe_fds[READ] : -1;
 				}
 				
-				// Free resources 
-				int i_args = 0;
-				while (args[i_args] != NULL)
+				// Read end of a pipe whose reader never started
+				if (fd_r != -1)
 				{
-					free(args[i_args++]);
-				}
-				 
-				free(input_file);
-				free(output_file);
-				free(piped_commands[i_piped]);
-			}
-			else // Not allowed input/output redirection from/to file
-			{
-				// Open pipe file descriptors
-				int i_fd, pipe_ok = 1;
-				int pipes_needed = (num_piped_commands - 1 < MAX_PIPES) ? num_piped_commands - 1 : MAX_PIPES;
-				for (i_fd = 0; i_fd < pipes_needed; i_fd++)
-				{
-					if (pipe(pipes[i_fd]) < 0)
-					{
-						perror("pipe");
-						pipe_ok = 0;
-						break;
-					}
+					close(fd_r);
 				}
 				
-				// Check if it is able to spawn processes
-				if (num_running_processes + num_piped_commands > MAX_RUNNING_PROCESSES)
+				// Wait for every command of the pipe sequence, unless it runs in the background
+				if (job != NULL && bg && job->num_processes > 0)
 				{
-					fprintf(stderr, "Insufficient Resources\n");
+					block_sigchld(&orig_mask);
+					job_run_background(job, 0);
+					sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+					last_exit_status = 0;
 				}
-				else if (pipe_ok)
+				else if (job != NULL)
 				{
-					int pid, index_r, index_w, bg, current_running = 0;
+					block_sigchld(&orig_mask);
+					int status = job_run_foreground(job, 0, &orig_mask);
+					sigprocmask(SIG_SETMASK, &orig_mask, NULL);
 					
-					// Initialize running piped commands to -1 so kill does not crash
-					for (current_running = 0; current_running < MAX_RUNNING_PROCESSES; current_running++)
+					// $? is the status of the last command, even when an earlier one could not run
+					if (pid > 0)
 					{
-						running_piped_commands[current_running] = -1;
+						last_exit_status = status;
 					}
-					current_running = 0;
-					
-					pipe_failure = 0;
-					
-					for (i_piped = 0; i_piped < num_piped_commands && !pipe_failure; i_piped++)
+					else if (pid < 0)
 					{
-						// Tokenize commands based on whitespaces
-						if ((num_args = tokenize(piped_commands[i_piped], " \t\n", args)) < 0)
-						{
-							fprintf(stderr, "Unable to tokenize arguments\n");
-							exit(1);
-						}
-						
-						// First command
-						if (i_piped == 0)
-						{
-							index_r = -1; // Default (STDIN)
-							index_w = i_piped;
-							bg = 1;
-						} 
-						// Last command
-						else if (i_piped == num_piped_commands - 1)
-						{
-							index_r = i_piped-1;
-							index_w = -1; // Default (STDOUT)
-							bg = 0; // Wait only for last command
-						} 
-						// In between commands
-						else
-						{
-							index_r = i_piped-1;
-							index_w = i_piped;
-							bg = 1;
-						}
-						
-						// Execute command
-						if ((pid = execute_piped(args, index_r, index_w, pipes, pipes_needed, bg)) < 0)
-						{
-							// Child
-							fprintf(stderr, "Unable to execute command\n");
-							
-							// Free resources 
-							int i_args = 0;
-							while (args[i_args] != NULL)
-							{
-								free(args[i_args++]);
-							}
-							
-							if (pid == EXIT_CHILD)
-							{
-								kill(getppid(), SIGUSR1);
-								exit(1); // Child
-							} 
-						}
-						else
-						{
-							num_forked_processes++;
-							running_piped_commands[current_running++] = pid;
-						}
-						
-						// Free resources 
-						int i_args = 0;
-						while (args[i_args] != NULL)
-						{
-							free(args[i_args++]);
-						}
+						last_exit_status = pipe_failure ? 127 : stage_status;
+					}
+					else
+					{
+						last_exit_status = stage_status; // Ran in the shell
 					}
-				}
-			
-				// Close any remaining open file descriptors
-				for (i_fd = 0; i_fd < pipes_needed; i_fd++)
-				{
-					close(pipes[i_fd][READ]);
-					close(pipes[i_fd][WRITE]);
-				}
-				
-				// Free resources
-				for (i_piped = 0; i_piped < num_piped_commands; i_piped++)
-				{
-					free(piped_commands[i_piped]);
 				}
 			}
-			
-			// Free resources
-			free(commands[i_comm]);
-			i_comm++;
 		}
 		
-		// Print history
-		//history(history_commands);
+		trace_event("command", command_line, command_start, stats_now(), 0, last_exit_status);
+		if (timed)
+		{
+			timer_report(&timer);
+		}
+		
+		i_comm = end + 1;
+	}
+}
+
+int execute_script(const char *text, size_t length)
+{
+	// Here-documents read their bodies from the same script
+	const char *outer_text = script_text;
+	size_t outer_length = script_length, outer_position = script_position;
+	script_text = text;
+	script_length = length;
+	script_position = 0;
+	
+	char *line = NULL;
+	size_t line_size = 0;
+	while (next_script_line(&line, &line_size, 1) >= 0)
+	{
+		execute_line(line);
+		
+		// Forget finished background jobs (nothing is reported without a terminal)
+		sigset_t orig_mask;
+		block_sigchld(&orig_mask);
+		jobs_notify();
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
 	}
+	
+	free(line);
+	script_text = outer_text;
+	script_length = outer_length;
+	script_position = outer_position;
 	return 0;
 }
 
-void signal_handler(int sig)
+// Copies the next line of the script into *line, joining lines ending in a backslash when join is set
+ssize_t next_script_line(char **line, size_t *line_size, int join)
 {
-	if (sig == SIGCHLD)
+	if (script_position >= script_length)
 	{
-		//printf("SIGCHLD\n");
-		int pid, status;
-		/* // HAD PROBLEMS WITH ZOMBIE CHILDREN
-		if ((pid = wait(&status)) > 0)
-		{
-			//printf("Process %d terminated with exit code %d\n", pid, status >> 8);
-			printf("Received SIGCHLD %d - ", pid);
-			remove_running_process(pid, running_processes);
-		}
-		*/
-		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) 
+		return -1;
+	}
+	
+	size_t line_length = 0;
+	while (1)
+	{
+		// Find the end of the current line
+		size_t start = script_position;
+		const char *newline = memchr(script_text + start, '\n', script_length - start);
+		size_t end = (newline != NULL) ? (size_t) (newline - script_text) : script_length;
+		script_position = end + 1;
+		
+		// Lines are copied since the lexer modifies them, the buffer only grows for longer lines
+		if (line_length + end - start + 1 > *line_size)
 		{
-			if (WIFEXITED(status)) 
+			size_t new_size = line_length + end - start + 1;
+			char *bigger = (char *) realloc(*line, new_size);
+			if (bigger == NULL)
 			{
-			    
-				//printf("Process %d terminated with exit code %d\n", pid, status >> 8);
-				//printf("Received SIGCHLD %d - ", pid);
-				remove_running_process(pid, running_processes);
+				perror("realloc");
+				return -1;
 			}
+			*line = bigger;
+			*line_size = new_size;
 		}
+		memcpy(*line + line_length, script_text + start, end - start);
+		line_length += end - start;
 		
-		return;
+		// An odd number of trailing backslashes escapes the newline -> join the next line
+		size_t backslashes = 0;
+		while (join && backslashes < line_length && (*line)[line_length - 1 - backslashes] == '\\')
+		{
+			backslashes++;
+		}
+		if (backslashes % 2 == 0 || script_position >= script_length)
+		{
+			break;
+		}
+		line_length--;
 	}
+	(*line)[line_length] = '\0';
 	
-	if (sig == SIGUSR1) // Pipe failure
-	{
-		kill_processes(running_piped_commands);
-		pipe_failure = 1;
-	}
-
-	if (sig == SIGINT)
-	{
-		char *args[2] = {NULL, NULL};
-		exit_shell(args);
-	}
+	return line_length;
 }
 
-int add_running_process(int pid, int *pids)
+// Reads every here-document body of the line into the token of its delimiter
+int read_here_documents(struct token *tokens, int count)
 {
+	static char *line = NULL, *body = NULL; // Kept between here-documents, the body is copied to the arena
+	static size_t line_size = 0, body_size = 0;
+	
 	int i;
-	for (i = 0; i < MAX_RUNNING_PROCESSES; i++)
+	for (i = 0; i < count; i++)
 	{
-		// Find empty space
-		if (pids[i] < 0)
+		if (tokens[i].type != TOKEN_DLESS && tokens[i].type != TOKEN_DLESSDASH)
+		{
+			continue;
+		}
+		if (i + 1 == count || tokens[i + 1].type != TOKEN_WORD)
+		{
+			fprintf(stderr, "Syntax error: missing here-document delimiter\n");
+			return -1;
+		}
+		
+		// Quotes in the delimiter turn off expansion in the body
+		char *word = tokens[i + 1].text;
+		int quoted = (strpbrk(word, "\'\"\\") != NULL);
+		char *delimiter = arena_strndup(&line_arena, word, strlen(word));
+		if (delimiter == NULL)
+		{
+			return -1;
+		}
+		char *end = delimiter;
+		char *c;
+		for (c = word; *c != '\0'; c++)
 		{
-			pids[i] = pid;
+			if (*c != '\'' && *c != '\"' && *c != '\\')
+			{
+				*end++ = *c;
+			}
+		}
+		*end = '\0';
+		
+		size_t body_length = 0;
+		while (1)
+		{
+			if (shell_is_interactive)
+			{
+				printf("> ");
+				fflush(stdout);
+			}
+			
+			ssize_t length = (script_text != NULL) ? next_script_line(&line, &line_size, 0) : read_line(&stdin_reader, &line, &line_size, "> ");
+			if (length < 0)
+			{
+				fprintf(stderr, "Warning: here-document delimited by end of input (wanted '%s')\n", delimiter);
+				break;
+			}
 			
-			num_running_processes++;
+			char *text = line;
+			if (tokens[i].type == TOKEN_DLESSDASH) // <<- removes leading tabs
+			{
+				while (*text == '\t')
+				{
+					text++;
+					length--;
+				}
+			}
+			if (strcmp(text, delimiter) == 0)
+			{
+				break;
+			}
 			
-			return i;
+			if (body_length + length + 2 > body_size)
+			{
+				size_t new_size = (body_size == 0) ? INPUT_BUF_SIZE : body_size;
+				while (body_length + length + 2 > new_size)
+				{
+					new_size *= 2;
+				}
+				char *bigger = (char *) realloc(body, new_size);
+				if (bigger == NULL)
+				{
+					perror("realloc");
+					return -1;
+				}
+				body = bigger;
+				body_size = new_size;
+			}
+			memcpy(body + body_length, text, length);
+			body_length += length;
+			body[body_length++] = '\n';
 		}
+		
+		tokens[i + 1].text = arena_strndup(&line_arena, (body != NULL) ? body : "", body_length);
+		if (tokens[i + 1].text == NULL)
+		{
+			return -1;
+		}
+		tokens[i + 1].delimiter = word;
+		tokens[i + 1].type = quoted ? TOKEN_HEREDOC_TEXT : TOKEN_HEREDOC_BODY;
 	}
 	
-	return -1; // Full
+	return 0;
 }
 
-int remove_running_process(int pid, int *pids)
+int execute_script_file(const char *path)
 {
-	int i;
-	for (i = 0; i < MAX_RUNNING_PROCESSES; i++)
+	int fd;
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
 	{
-		// Find process pid
-		if (pids[i] == pid)
-		{
-			pids[i] = -1;
-			//printf("Removed %d\n", pid);
-			num_running_processes--;
-			
-			return i;
-		}
+		perror(path);
+		return 127;
+	}
+	
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+	{
+		perror(path);
+		close(fd);
+		return 126;
+	}
+	
+	if (st.st_size == 0) // Nothing to run (and mmap does not accept empty files)
+	{
+		close(fd);
+		return 0;
+	}
+	
+	// Map the whole script, lines are read straight from memory without any read calls
+	char *text = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED)
+	{
+		perror("mmap");
+		return 126;
 	}
-	//printf("Couldn't find %d\n", pid);
-	return -1; // Not found
+	madvise(text, st.st_size, MADV_SEQUENTIAL);
+	
+	execute_script(text, st.st_size);
+	
+	munmap(text, st.st_size);
+	return last_exit_status;
 }
 
-int execute_piped(char **argv, int index_r, int index_w, int (*pipes)[2], int num_pipes, int bg)
+void signal_handler(int sig)
 {
-	if (is_variable_assignment(argv[0]))
+	if (sig == SIGCHLD)
 	{
-		return variable_assignment(argv[0]);
+		jobs_handle_sigchld();
+		return;
 	}
-	
-	int built_in_index = is_built_in(argv[0]);
-	if ((built_in_index == 7 && argv[1] != NULL) /*export*/ || (built_in_index >=0 && !built_in_spawn_child[built_in_index])) 
+
+	if (sig == SIGINT)
 	{
-		return execute_built_in(argv, built_in_index);
+		char *args[2] = {NULL, NULL};
+		exit_shell(args, STDOUT_FILENO);
 	}
+}
 
-	int pid; //, status;
-	if ((pid = fork()) < 0)
+int spawn_command(char **argv, char **envp, int fd_r, int fd_w, struct redirect *redirects, sigset_t *child_mask, int pgid, int foreground)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	int pid, err;
+	
+	if (fd_r == -1 && !redirect_touches(redirects, STDIN_FILENO)) // Child reads the shell's input -> it must start right after the current line
 	{
-		perror("fork"); return -1;
-	}	
-	else if (pid == 0) // Child process
+		line_reader_sync(&stdin_reader);
+	}
+	
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+	
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 35)
+	// First process of a foreground job owns the terminal before it runs, a stage reading it right away is not stopped (SIGTTIN)
+	if (shell_is_interactive && foreground && pgid == 0)
 	{
-		// Redirect input
-		if (index_r != -1)
-		{
-			close(pipes[index_r][WRITE]); // Close write end
-			close(STDIN_FILENO);
-			if (dup2(pipes[index_r][READ], STDIN_FILENO) < 0)
-			{
-				perror("dup2");	
-			}
-			close(pipes[index_r][READ]);
-		}
-		
-		// Redirect output
-		if (index_w != -1)
+		posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+	}
+#endif
+	
+	// Same redirections the forked child used to perform by hand
+	if (fd_r != -1 && fd_r != STDIN_FILENO)
+	{
+		posix_spawn_file_actions_adddup2(&actions, fd_r, STDIN_FILENO);
+	}
+	if (fd_w != -1 && fd_w != STDOUT_FILENO)
+	{
+		posix_spawn_file_actions_adddup2(&actions, fd_w, STDOUT_FILENO);
+	}
+	redirect_spawn_actions(redirects, &actions); // After the pipe ends, so 2>&1 follows stdout into the pipe
+	
+	// Child starts with the mask the shell had before SIGCHLD was blocked and default job control signals
+	sigset_t default_signals;
+	sigemptyset(&default_signals);
+	sigaddset(&default_signals, SIGINT);
+	sigaddset(&default_signals, SIGQUIT);
+	sigaddset(&default_signals, SIGTSTP);
+	sigaddset(&default_signals, SIGTTIN);
+	sigaddset(&default_signals, SIGTTOU);
+	posix_spawnattr_setsigmask(&attr, child_mask);
+	posix_spawnattr_setsigdefault(&attr, &default_signals);
+	
+	short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+	if (shell_is_interactive) // Job control -> own process group per job
+	{
+		posix_spawnattr_setpgroup(&attr, pgid);
+		flags |= POSIX_SPAWN_SETPGROUP;
+	}
+	posix_spawnattr_setflags(&attr, flags);
+	
+	unsigned long long spawn_start = stats_now();
+	const char *path = path_lookup(argv[0]);
+	if (path == NULL)
+	{
+		err = ENOENT;
+	}
+	else if ((err = posix_spawn(&pid, path, &actions, &attr, argv, envp)) == ENOENT && path != argv[0])
+	{
+		// Cached path is stale (command moved or removed) -> search $PATH again
+		path_cache_forget(argv[0]);
+		path = path_lookup(argv[0]);
+		err = (path == NULL) ? ENOENT : posix_spawn(&pid, path, &actions, &attr, argv, envp);
+	}
+	if (err == ENOEXEC) // Executable without a #! line -> a shell script, run by /bin/sh like execvp does
+	{
+		int argc = 0;
+		while (argv[argc] != NULL)
 		{
-			close(pipes[index_w][READ]); // Close read end
-			close(STDOUT_FILENO);
-			if (dup2(pipes[index_w][WRITE], STDOUT_FILENO) < 0)
-			{
-				perror("dup2");	
-			}			
-			close(pipes[index_w][WRITE]);
+			argc++;
 		}
-		
-		if (built_in_index >= 0) // If command is built-in
+		char **sh_argv = (char **) arena_alloc(&line_arena, (argc + 2) * sizeof(char *));
+		if (sh_argv == NULL)
 		{
-			exit(execute_built_in(argv, built_in_index));
+			err = ENOMEM;
 		}
-
-		// Else normal command
-		if (execvp(argv[0], argv) < 0)
+		else
 		{
-			perror(argv[0]); 
-			return EXIT_CHILD;
+			sh_argv[0] = "/bin/sh";
+			sh_argv[1] = (char *) path;
+			memcpy(sh_argv + 2, argv + 1, argc * sizeof(char *)); // Arguments and the NULL after them
+			err = posix_spawn(&pid, "/bin/sh", &actions, &attr, sh_argv, envp);
 		}
 	}
-	else // Parent process
-	{	
-		int index = add_running_process(pid, running_processes);
-		
-		if (index_r != -1)
-		{
-			close(pipes[index_r][READ]);
-			close(pipes[index_r][WRITE]);
-		}
-		// Close open pipe file descriptors when at last command
-		if (!bg)
+	
+	if (err != 0)
+	{
+		errno = err;
+		perror(argv[0]);
+		pid = -1;
+		stats_counters[STAT_SPAWN_FAILURES]++;
+	}
+	else
+	{
+		num_forked_processes++;
+		stats_counters[STAT_SPAWNS]++;
+		stats_record_since(HIST_SPAWN, spawn_start);
+		trace_event("spawn", argv[0], spawn_start, stats_now(), 0, -1);
+		if (stats_line_start != 0) // First process of the line
 		{
-			// Busy waiting -> stop when remove_running_process called
-			while (running_processes[index] == pid);
+			stats_record_since(HIST_FIRST_EXEC, stats_line_start);
+			stats_line_start = 0;
 		}
 	}
 	
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	
 	return pid;
 }
 
-int execute(char **argv, int fd_r, int fd_w, int bg)
+void *pump_built_in_output(void *arg)
 {
-	if (is_variable_assignment(argv[0]))
+	int *fds = (int *) arg; // {memfd, fd_w, size}
+	off_t offset = 0;
+	while (offset < fds[2])
 	{
-		return variable_assignment(argv[0]);
+		if (sendfile(fds[1], fds[0], &offset, fds[2] - offset) <= 0)
+		{
+			break; // Reader went away (EPIPE) or error
+		}
 	}
+	
+	close(fds[0]);
+	close(fds[1]);
+	free(fds);
+	return NULL;
+}
 
-	if (num_running_processes >= MAX_RUNNING_PROCESSES)
+int execute_built_in_piped(char **argv, int built_in_index, int memfd, int fd_w)
+{
+	// Run the built-in in the shell itself, capturing its output in memory
+	int exit_code = execute_built_in(argv, built_in_index, memfd);
+	
+	int *fds = (int *) malloc(3 * sizeof(int));
+	if (fds == NULL)
 	{
-		fprintf(stderr, "Insufficient Resources\n");
+		perror("malloc");
+		close(memfd);
 		return -1;
 	}
+	fds[0] = memfd;
+	fds[1] = fcntl(fd_w, F_DUPFD_CLOEXEC, 0); // Caller closes its own copy of fd_w
+	fds[2] = lseek(memfd, 0, SEEK_CUR);
 	
-	int built_in_index = is_built_in(argv[0]);
-	if (built_in_index >=0 && !built_in_spawn_child[built_in_index]) 
+	if (fds[1] < 0)
+	{
+		perror("fcntl");
+		close(memfd);
+		free(fds);
+		return -1;
+	}
+	
+	// Fits in the pipe -> write it now, the reader does not have to be running yet
+	if (fds[2] <= fcntl(fds[1], F_GETPIPE_SZ))
 	{
-		return execute_built_in(argv, built_in_index);
+		pump_built_in_output(fds);
+		return exit_code;
 	}
+	
+	// Larger output -> a helper thread keeps feeding the pipe while the rest of the sequence starts
+	sigset_t all_signals, orig_mask;
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &orig_mask); // Thread gets EPIPE instead of SIGPIPE, never takes SIGCHLD
+	
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, pump_built_in_output, fds) != 0)
+	{
+		fprintf(stderr, "Unable to start output thread\n");
+		pump_built_in_output(fds);
+	}
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &orig_mask, NULL);
+	
+	return exit_code;
+}
 
-	int pid; //, status;
-	if ((pid = fork()) < 0)
+int execute_piped(char **argv, struct redirect *redirects, struct job *job, int fd_r, int fd_w)
+{
+	int result;
+	int num_assignments = count_assignments(argv);
+	if (argv[num_assignments] == NULL) // Only assignments -> set shell variables
 	{
-		perror("fork"); return -1;
-	}	
-	else if (pid == 0) // Child process
+		result = assign_variables(argv, num_assignments);
+		last_exit_status = (result < 0) ? 1 : substitution_status; // x=$(cmd) -> status of cmd
+		return (result < 0) ? -1 : 0;
+	}
+	
+	// Prefix assignments only go to the environment of this command
+	char **envp = var_environment_with(argv, num_assignments, &line_arena);
+	if (envp == NULL)
 	{
-		// Redirect input
-		if (fd_r != -1)
+		pipe_failure = 1;
+		return -1;
+	}
+	argv += num_assignments;
+	
+	int built_in_index = is_built_in(argv[0]);
+	if (built_in_index >= 0) // Built-in commands run in the shell, no fork needed
+	{
+		command_environment = (num_assignments > 0) ? envp : NULL;
+		command_input = (redirect_input(redirects) != -1) ? redirect_input(redirects) : fd_r;
+		
+		// Output to the pipe is captured in memory, stdout points there while the built-in runs so 2>&1 follows it
+		int memfd = -1, saved_stdout = -1;
+		if (fd_w != -1 && !redirect_touches(redirects, STDOUT_FILENO))
 		{
-			close(STDIN_FILENO);
-			if (dup2(fd_r, STDIN_FILENO) < 0)
+			if ((memfd = memfd_create("ucysh-built-in", MFD_CLOEXEC)) < 0)
 			{
-				perror("dup2");	
+				perror("memfd_create");
+				return -1;
 			}
-			close(fd_r);
+			fflush(stdout);
+			saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+			dup2(memfd, STDOUT_FILENO);
 		}
 		
-		// Redirect output
-		if (fd_w != -1)
+		if (redirect_save(redirects) < 0)
 		{
-			close(STDOUT_FILENO);
-			if (dup2(fd_w, STDOUT_FILENO) < 0)
+			result = -1;
+			if (memfd >= 0)
 			{
-				perror("dup2");	
-			}			
-			close(fd_w);
+				close(memfd);
+			}
 		}
-		
-		if (built_in_index >= 0) // If command is built-in
+		else if (memfd < 0) // Last command or stdout redirected -> straight to stdout
 		{
-			exit(execute_built_in(argv, built_in_index));
+			result = execute_built_in(argv, built_in_index, STDOUT_FILENO);
 		}
-
-		// Else normal command
-		if (execvp(argv[0], argv) < 0)
+		else
 		{
-			perror(argv[0]); 
-			return EXIT_CHILD;
+			result = execute_built_in_piped(argv, built_in_index, memfd, fd_w);
 		}
+		redirect_restore(redirects);
+		
+		if (memfd >= 0)
+		{
+			fflush(stdout);
+			if (saved_stdout >= 0)
+			{
+				dup2(saved_stdout, STDOUT_FILENO);
+				close(saved_stdout);
+			}
+			else
+			{
+				close(STDOUT_FILENO); // stdout was closed before
+			}
+		}
+		command_environment = NULL;
+		command_input = -1;
+		last_exit_status = (result < 0) ? 1 : result;
+		return (result < 0) ? -1 : 0;
+	}
+	
+	sigset_t orig_mask;
+	block_sigchld(&orig_mask);
+
+	int pid = spawn_command(argv, envp, fd_r, fd_w, redirects, &orig_mask, job->pgid, !job->bg);
+	if (pid < 0)
+	{
+		// Command could not start -> the others still run, its neighbours see its pipe ends closed
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+		last_exit_status = 127;
+		return -1;
+	}
+	
+	job_add_process(job, pid, argv[0]);
+	if (shell_is_interactive && !job->bg && job->num_processes == 1) // Later stages join a group that already has the terminal
+	{
+		tcsetpgrp(STDIN_FILENO, job->pgid);
 	}
-	else // Parent process
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+	
+	return pid;
+}
+
+int execute(char **argv, struct redirect *redirects, int bg, const char *command_line)
+{
+	int result;
+	int num_assignments = count_assignments(argv);
+	if (argv[num_assignments] == NULL) // Only assignments -> set shell variables
+	{
+		result = assign_variables(argv, num_assignments);
+		last_exit_status = (result < 0) ? 1 : substitution_status; // x=$(cmd) -> status of cmd
+		return result;
+	}
+	
+	// Prefix assignments only go to the environment of this command
+	char **envp = var_environment_with(argv, num_assignments, &line_arena);
+	if (envp == NULL)
+	{
+		last_exit_status = 1;
+		return -1;
+	}
+	argv += num_assignments;
+	
+	int built_in_index = is_built_in(argv[0]);
+	if (built_in_index >= 0) // Built-in commands run in the shell with its descriptors redirected for the duration
 	{
-		int index = add_running_process(pid, running_processes);
-		if (bg) // Background -> don't wait
+		command_environment = (num_assignments > 0) ? envp : NULL;
+		command_input = redirect_input(redirects);
+		result = (redirect_save(redirects) < 0) ? -1 : execute_built_in(argv, built_in_index, STDOUT_FILENO);
+		if (strcmp(argv[0], "exec") == 0 && argv[1] == NULL) // exec without a command keeps them for the shell
 		{
-			//printf("%d\n", pid);
+			redirect_commit(redirects);
 		}
-		else // Foreground -> no need to add to running processes since parent will wait
+		else
 		{
-			// Busy waiting -> stop when remove_running_process called
-			while (running_processes[index] == pid);
+			redirect_restore(redirects);
 		}
+		command_environment = NULL;
+		command_input = -1;
+		last_exit_status = (result < 0) ? 1 : result;
+		return result;
 	}
 	
-	return pid;
-}
-
+	// Only commands that start a process count against the soft limit (wait and jobs must still work at it)
+	if (!jobs_can_start(1))
+	{
+		fprintf(stderr, "Insufficient Resources\n");
+		last_exit_status = 1;
+		return -1;
+	}
 
+	struct job *job;
+	if ((job = job_create(command_line)) == NULL)
+	{
+		last_exit_status = 1;
+		return -1;
+	}
+	
+	sigset_t orig_mask;
+	block_sigchld(&orig_mask);
 
+	int pid = spawn_command(argv, envp, -1, -1, redirects, &orig_mask, 0, !bg);
+	if (pid < 0)
+	{
+		job_free(job);
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+		last_exit_status = 127;
+		return -1;
+	}
+	job_add_process(job, pid, argv[0]);
+	
+	if (bg) // Background -> don't wait, reported by jobs_notify() once done
+	{
+		job_run_background(job, 0);
+	}
+	else // Foreground -> owns the terminal until it finishes or stops
+	{
+		last_exit_status = job_run_foreground(job, 0, &orig_mask);
+	}
+	sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+	
+	return pid;
+}
@@ -0,0 +1,424 @@
+#include "variables.h"
+
+// Marks a slot whose variable was unset, so probe sequences running through it are not cut short
+static struct variable deleted_slot;
+#define DELETED (&deleted_slot)
+
+static struct variable **slots = NULL;
+static int num_slots = 0; // Always a power of two
+static int num_variables = 0;
+static int num_deleted = 0;
+
+static char **environment = NULL; // Packed envp of the exported variables, one allocation
+static int environment_dirty = 1; // An exported variable changed since environment was built
+static char *empty_environment[1] = {NULL};
+
+// Same hash as hash_string but over the first len characters of name
+static unsigned int hash_name(const char *name, size_t len)
+{
+	unsigned int hash = 5381;
+	size_t i;
+	for (i = 0; i < len; i++)
+	{
+		hash = hash * 33 + (unsigned char) name[i];
+	}
+	
+	return hash;
+}
+
+// Returns the slot holding name, or -1 if it is not set
+static int find_slot(const char *name, size_t len, unsigned int hash)
+{
+	if (slots == NULL)
+	{
+		return -1;
+	}
+	
+	int mask = num_slots - 1;
+	int slot = hash & mask;
+	while (slots[slot] != NULL)
+	{
+		struct variable *var = slots[slot];
+		if (var != DELETED && var->hash == hash && strncmp(var->name, name, len) == 0 && var->name[len] == '\0')
+		{
+			return slot;
+		}
+		slot = (slot + 1) & mask;
+	}
+	
+	return -1;
+}
+
+// Rebuilds the table with room for more variables, dropping deleted slots
+static int resize_slots(void)
+{
+	int new_size = (num_slots == 0) ? VARIABLES_INITIAL_SLOTS : num_slots;
+	while (num_variables * 4 >= new_size)
+	{
+		new_size *= 2;
+	}
+	
+	struct variable **new_slots = (struct variable **) calloc(new_size, sizeof(struct variable *));
+	if (new_slots == NULL)
+	{
+		perror("calloc");
+		return -1;
+	}
+	
+	int i;
+	for (i = 0; i < num_slots; i++)
+	{
+		struct variable *var = slots[i];
+		if (var != NULL && var != DELETED)
+		{
+			int slot = var->hash & (new_size - 1);
+			while (new_slots[slot] != NULL)
+			{
+				slot = (slot + 1) & (new_size - 1);
+			}
+			new_slots[slot] = var;
+		}
+	}
+	
+	free(slots);
+	slots = new_slots;
+	num_slots = new_size;
+	num_deleted = 0;
+	return 0;
+}
+
+// Adds a new variable, the table must not already contain name
+static struct variable *insert_variable(const char *name, size_t len, unsigned int hash)
+{
+	// Keep at least half of the slots empty so probe sequences stay short
+	if ((num_variables + num_deleted + 1) * 2 > num_slots && resize_slots() < 0)
+	{
+		return NULL;
+	}
+	
+	struct variable *var = (struct variable *) malloc(sizeof(struct variable));
+	if (var == NULL)
+	{
+		perror("malloc");
+		return NULL;
+	}
+	var->name = strndup(name, len);
+	if (var->name == NULL)
+	{
+		perror("strndup");
+		free(var);
+		return NULL;
+	}
+	var->value = NULL;
+	var->flags = 0;
+	var->hash = hash;
+	
+	int mask = num_slots - 1;
+	int slot = hash & mask;
+	while (slots[slot] != NULL && slots[slot] != DELETED)
+	{
+		slot = (slot + 1) & mask;
+	}
+	if (slots[slot] == DELETED)
+	{
+		num_deleted--;
+	}
+	slots[slot] = var;
+	num_variables++;
+	
+	return var;
+}
+
+// Returns the variable called name, NULL if it is not set
+struct variable *var_lookup(const char *name)
+{
+	size_t len = strlen(name);
+	int slot = find_slot(name, len, hash_name(name, len));
+	return (slot < 0) ? NULL : slots[slot];
+}
+
+// Returns the value of name, NULL if it is not set
+const char *var_get(const char *name)
+{
+	struct variable *var = var_lookup(name);
+	return (var == NULL) ? NULL : var->value;
+}
+
+// Same as var_get but name is the first name_len characters of name
+const char *var_getn(const char *name, size_t name_len)
+{
+	int slot = find_slot(name, name_len, hash_name(name, name_len));
+	return (slot < 0) ? NULL : slots[slot]->value;
+}
+
+// Sets name to value and adds flags to it
+int var_set(const char *name, const char *value, int flags)
+{
+	return var_setn(name, strlen(name), value, flags);
+}
+
+// Same as var_set but name is the first name_len characters of name
+int var_setn(const char *name, size_t name_len, const char *value, int flags)
+{
+	unsigned int hash = hash_name(name, name_len);
+	int slot = find_slot(name, name_len, hash);
+	struct variable *var;
+	if (slot >= 0)
+	{
+		var = slots[slot];
+		if (var->flags & VAR_READONLY)
+		{
+			fprintf(stderr, "%s: readonly variable\n", var->name);
+			return -1;
+		}
+	}
+	else if ((var = insert_variable(name, name_len, hash)) == NULL)
+	{
+		return -1;
+	}
+	
+	char *new_value = strdup(value);
+	if (new_value == NULL)
+	{
+		perror("strdup");
+		return -1;
+	}
+	free(var->value);
+	var->value = new_value;
+	var->flags |= flags;
+	
+	if (var->flags & VAR_EXPORTED)
+	{
+		environment_dirty = 1;
+	}
+	if (strcmp(var->name, "PATH") == 0) // Cached command paths may no longer apply
+	{
+		path_cache_clear();
+	}
+	
+	return 0;
+}
+
+// Adds flags to an existing variable
+int var_set_flags(const char *name, int flags)
+{
+	struct variable *var = var_lookup(name);
+	if (var == NULL)
+	{
+		return -1;
+	}
+	
+	if ((flags & VAR_EXPORTED) && !(var->flags & VAR_EXPORTED))
+	{
+		environment_dirty = 1;
+	}
+	var->flags |= flags;
+	
+	return 0;
+}
+
+// Removes a variable
+int var_unset(const char *name)
+{
+	size_t len = strlen(name);
+	int slot = find_slot(name, len, hash_name(name, len));
+	if (slot < 0)
+	{
+		return 0;
+	}
+	
+	struct variable *var = slots[slot];
+	if (var->flags & VAR_READONLY)
+	{
+		fprintf(stderr, "%s: readonly variable\n", var->name);
+		return -1;
+	}
+	
+	if (var->flags & VAR_EXPORTED)
+	{
+		environment_dirty = 1;
+	}
+	if (strcmp(var->name, "PATH") == 0)
+	{
+		path_cache_clear();
+	}
+	
+	slots[slot] = DELETED;
+	num_variables--;
+	num_deleted++;
+	free(var->name);
+	free(var->value);
+	free(var);
+	
+	return 0;
+}
+
+// Returns the next variable after slot *position, NULL after the last one
+struct variable *var_next(int *position)
+{
+	while (*position < num_slots)
+	{
+		struct variable *var = slots[(*position)++];
+		if (var != NULL && var != DELETED)
+		{
+			return var;
+		}
+	}
+	
+	return NULL;
+}
+
+// Returns the "name=value" array of exported variables, rebuilt only after an exported variable changed
+char **var_environment(void)
+{
+	if (!environment_dirty && environment != NULL)
+	{
+		return environment;
+	}
+	
+	// Pointer array followed by the strings, so the whole snapshot is a single allocation
+	int count = 0;
+	size_t bytes = 0;
+	int position = 0;
+	struct variable *var;
+	while ((var = var_next(&position)) != NULL)
+	{
+		if (var->flags & VAR_EXPORTED)
+		{
+			count++;
+			bytes += strlen(var->name) + strlen(var->value) + 2;
+		}
+	}
+	
+	char **new_environment = (char **) malloc((count + 1) * sizeof(char *) + bytes);
+	if (new_environment == NULL)
+	{
+		perror("malloc");
+		return (environment != NULL) ? environment : empty_environment; // Stale or empty environment
+	}
+	
+	char *strings = (char *) (new_environment + count + 1);
+	int i = 0;
+	position = 0;
+	while ((var = var_next(&position)) != NULL)
+	{
+		if (var->flags & VAR_EXPORTED)
+		{
+			new_environment[i++] = strings;
+			strings += sprintf(strings, "%s=%s", var->name, var->value) + 1;
+		}
+	}
+	new_environment[i] = NULL;
+	
+	free(environment);
+	environment = new_environment;
+	environment_dirty = 0;
+	return environment;
+}
+
+// Returns the exported variables with count "name=value" assignments laid over them, allocated in arena
+char **var_environment_with(char **assignments, int count, struct arena *arena)
+{
+	char **base = var_environment();
+	if (count == 0)
+	{
+		return base;
+	}
+	
+	int num_base = 0;
+	while (base[num_base] != NULL)
+	{
+		num_base++;
+	}
+	
+	char **envp = (char **) arena_alloc(arena, (num_base + count + 1) * sizeof(char *));
+	if (envp == NULL)
+	{
+		return NULL;
+	}
+	memcpy(envp, base, num_base * sizeof(char *));
+	
+	int num_envp = num_base;
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		size_t name_len = strchr(assignments[i], '=') - assignments[i] + 1; // Including '='
+		
+		// Replace the inherited value if there is one
+		int j;
+		for (j = 0; j < num_envp; j++)
+		{
+			if (strncmp(envp[j], assignments[i], name_len) == 0)
+			{
+				break;
+			}
+		}
+		envp[j] = assignments[i];
+		if (j == num_envp)
+		{
+			num_envp++;
+		}
+	}
+	envp[num_envp] = NULL;
+	
+	return envp;
+}
+
+// Adds every "name=value" entry of envp as an exported variable
+void var_import_environment(char **envp)
+{
+	int i;
+	for (i = 0; envp[i] != NULL; i++)
+	{
+		char *eq = strchr(envp[i], '=');
+		if (eq == NULL || eq == envp[i])
+		{
+			continue;
+		}
+		
+		size_t len = eq - envp[i];
+		unsigned int hash = hash_name(envp[i], len);
+		int slot = find_slot(envp[i], len, hash);
+		struct variable *var = (slot >= 0) ? slots[slot] : insert_variable(envp[i], len, hash);
+		if (var == NULL)
+		{
+			return;
+		}
+		
+		char *value = strdup(eq + 1);
+		if (value == NULL)
+		{
+			perror("strdup");
+			return;
+		}
+		free(var->value);
+		var->value = value;
+		var->flags |= VAR_EXPORTED;
+		environment_dirty = 1;
+	}
+}
+
+// Frees every variable
+void var_clear(void)
+{
+	int i;
+	for (i = 0; i < num_slots; i++)
+	{
+		struct variable *var = slots[i];
+		if (var != NULL && var != DELETED)
+		{
+			free(var->name);
+			free(var->value);
+			free(var);
+		}
+	}
+	
+	free(slots);
+	free(environment);
+	slots = NULL;
+	environment = NULL;
+	environment_dirty = 1;
+	num_slots = 0;
+	num_variables = 0;
+	num_deleted = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "helper_functions.h"
+#include "path_cache.h"
+#include "arena.h"
+
+#define VARIABLES_INITIAL_SLOTS 64
+
+#define VAR_EXPORTED 1 // Passed to the environment of launched commands
+#define VAR_READONLY 2 // Cannot be assigned or unset
+
+struct variable
+{
+	char *name;
+	char *value;
+	int flags; // VAR_EXPORTED | VAR_READONLY
+	unsigned int hash; // hash_string(name), kept to make rehashing cheap
+};
+
+// Returns the variable called name, NULL if it is not set
+struct variable *var_lookup(const char *name);
+
+// Returns the value of name, NULL if it is not set
+const char *var_get(const char *name);
+
+// Same as var_get but name is the first name_len characters of name
+const char *var_getn(const char *name, size_t name_len);
+
+// Sets name to value and adds flags to it, changing an exported variable marks the environment for rebuilding
+// Returns -1 if the variable is readonly or memory ran out
+int var_set(const char *name, const char *value, int flags);
+
+// Same as var_set but name is the first name_len characters of name (e.g. a "name=value" word)
+int var_setn(const char *name, size_t name_len, const char *value, int flags);
+
+// Adds flags to an existing variable, returns -1 if it is not set
+int var_set_flags(const char *name, int flags);
+
+// Removes a variable, returns -1 if it is readonly
+int var_unset(const char *name);
+
+// Returns the next variable after slot *position (start with *position = 0), NULL after the last one
+struct variable *var_next(int *position);
+
+// Returns the "name=value" array of exported variables for execve/posix_spawn
+// Rebuilt only after an exported variable changed, the array stays valid until then
+char **var_environment(void);
+
+// Returns the exported variables with count "name=value" assignments laid over them, allocated in arena
+// The shell's own variables are not changed (e.g. for "FOO=1 cmd")
+char **var_environment_with(char **assignments, int count, struct arena *arena);
+
+// Adds every "name=value" entry of envp as an exported variable
+void var_import_environment(char **envp);
+
+// Frees every variable
+void var_clear(void);
+
+#endif